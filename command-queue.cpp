@@ -3,14 +3,15 @@
 #include "command-queue.h"
 namespace GPGPU_LIB
 {
-	CommandQueue::CommandQueue(Context con) :queue(con.context, con.device.device)
+	CommandQueue::CommandQueue(Context con) :queue(con.context, con.device.device, CL_QUEUE_PROFILING_ENABLE)
 	{
 		sharesRAM = con.device.sharesRAM;
 	}
 
 	void CommandQueue::run(Kernel& kernel, size_t globalOffset, size_t nGlobal, size_t nLocal, size_t offset)
 	{
-		cl_int op = queue.enqueueNDRangeKernel(kernel.kernel, cl::NDRange(offset + globalOffset), cl::NDRange(nGlobal), cl::NDRange(nLocal));
+		kernelEvents.emplace_back();
+		cl_int op = queue.enqueueNDRangeKernel(kernel.kernel, cl::NDRange(offset + globalOffset), cl::NDRange(nGlobal), cl::NDRange(nLocal), nullptr, &kernelEvents.back());
 		if (op != CL_SUCCESS)
 		{
 			throw std::invalid_argument(std::string("enqueueNDRangeKernel error: ") + getErrorString(op));
@@ -22,11 +23,32 @@ namespace GPGPU_LIB
 	void CommandQueue::setPrm(Kernel& kernel, Parameter& prm, int idx)
 	{
 		cl_int op = 0;
-		kernel.mapParameterNameToParameter[prm.name] = prm;
+
+		// position is taken by this parameter now, old one is not copied (or recorded as written) by runs of this kernel anymore
+		for (auto it = kernel.argumentPositions.begin(); it != kernel.argumentPositions.end();)
+		{
+			if (it->second == idx && it->first != prm.id)
+			{
+				kernel.mapParameterIdToParameter.erase(it->first);
+				kernel.tileArgumentPositions.erase(it->first);
+				it = kernel.argumentPositions.erase(it);
+			}
+			else
+				++it;
+		}
+		kernel.argumentPositions[prm.id] = idx;
+		kernel.tileArgumentPositions.erase(prm.id);
+		kernel.mapParameterIdToParameter[prm.id] = prm;
 		
 			
 		cl::size_type st = prm.elementSize;	
-		if (prm.n == 1 && prm.isScalar())
+
+		if (prm.tiles)
+		{
+			// bound to a slot when a tile is computed
+			kernel.tileArgumentPositions[prm.id] = idx;
+		}
+		else if (prm.n == 1 && prm.isScalar())
 		{
 			
 			kernel.kernel.setArg(idx, st, prm.hostPrm.quickPtr);
@@ -40,49 +62,114 @@ namespace GPGPU_LIB
 		}
 	}
 
-	void CommandQueue::copyInputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement)
+	void CommandQueue::inputRange(Parameter& prm, size_t globalOffset, size_t offsetElement, size_t numElement, size_t& offsetBytes, size_t& sizeBytes)
+	{
+		if (prm.readAll)
+		{
+			offsetBytes = 0;
+			sizeBytes = prm.elementSize * prm.n;
+			return;
+		}
+
+		// region of work-items, extended by halo on both sides (clamped to the array) at the same positions in device buffer so kernel indexing is unchanged
+		const size_t begin = (globalOffset + offsetElement) * prm.elementsPerThread;
+		const size_t end = begin + numElement * prm.elementsPerThread;
+		const size_t haloBegin = begin > prm.haloElements ? begin - prm.haloElements : 0;
+		const size_t haloEnd = std::min(end + prm.haloElements, prm.n);
+		offsetBytes = haloBegin * prm.elementSize;
+		sizeBytes = (haloEnd > haloBegin ? haloEnd - haloBegin : 0) * prm.elementSize;
+	}
+
+	void CommandQueue::pendingUploadsOfOtherQueues(Parameter& prm, std::vector<cl::Event>& events) const
+	{
+		std::map<const CommandQueue*, cl::Event>& uploads = prm.resident->uploads;
+		for (auto it = uploads.begin(); it != uploads.end();)
+		{
+			// uploads of this queue complete before its next commands anyway
+			if (it->first == this)
+			{
+				++it;
+				continue;
+			}
+
+			cl_int status = CL_COMPLETE;
+			it->second.getInfo(CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+			if (status == CL_COMPLETE || status < 0)
+			{
+				it = uploads.erase(it);
+				continue;
+			}
+			events.push_back(it->second);
+			++it;
+		}
+	}
+
+	void CommandQueue::copyInputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement, bool includeWholeArrays)
 	{
+		std::vector<cl::Event> pendingUploads;
 		if (!sharesRAM)
 		{
-			for (auto& e : kernel.mapParameterNameToParameter)
+			for (auto& e : kernel.mapParameterIdToParameter)
 			{				
-				if (e.second.readOp)
+				if (e.second.readOp && !e.second.tiles && (includeWholeArrays || !e.second.readAll))
 				{
-					
+					size_t offsetBytes;
+					size_t sizeBytes;
+					inputRange(e.second, globalOffset, offsetElement, numElement, offsetBytes, sizeBytes);
+
+					// unchanged host data that device already has (lookup tables, constants) is not sent again
+					// in-place parameters are changed by kernels of all devices so their regions are always sent
+					if (!e.second.writeOp && !e.second.requiresUpload(offsetBytes, offsetBytes + sizeBytes))
+					{
+						pendingUploadsOfOtherQueues(e.second, pendingUploads);
+						continue;
+					}
+
+					uploadEvents.emplace_back();
 					cl_int op = queue.enqueueWriteBuffer(
 						e.second.buffer,
 						CL_FALSE,
-						e.second.readAll ? 0 : (globalOffset * e.second.elementSize * e.second.elementsPerThread + offsetElement * e.second.elementSize * e.second.elementsPerThread),
-						e.second.readAll ? (e.second.elementSize * e.second.n) : (numElement * e.second.elementSize * e.second.elementsPerThread),
-						e.second.hostPrm.quickPtr +
-						(
-							e.second.readAll ? 0 : (globalOffset * e.second.elementSize + offsetElement * e.second.elementSize * e.second.elementsPerThread)
-							)
+						offsetBytes,
+						sizeBytes,
+						e.second.hostPrm.quickPtr + offsetBytes,
+						nullptr,
+						&uploadEvents.back()
 					);
 					if (op != CL_SUCCESS)
 					{
 						throw std::invalid_argument(std::string("enqueueReadBuffer error: ") + getErrorString(op));
 					}
+					if (!e.second.writeOp)
+						e.second.resident->uploads[this] = uploadEvents.back();
 				}
 			}
 		}
 		else
 		{
-			for (auto& e : kernel.mapParameterNameToParameter)
+			for (auto& e : kernel.mapParameterIdToParameter)
 			{
 
-				if (e.second.readOp)
+				if (e.second.readOp && !e.second.tiles && (includeWholeArrays || !e.second.readAll))
 				{
-					
+					size_t offsetBytes;
+					size_t sizeBytes;
+					inputRange(e.second, globalOffset, offsetElement, numElement, offsetBytes, sizeBytes);
+					if (!e.second.writeOp && !e.second.requiresUpload(offsetBytes, offsetBytes + sizeBytes))
+					{
+						pendingUploadsOfOtherQueues(e.second, pendingUploads);
+						continue;
+					}
+
 					cl_int op;
+					uploadEvents.emplace_back();
 					void* ptrMap = queue.enqueueMapBuffer(
 						e.second.buffer,
 						CL_FALSE,
 						CL_MAP_WRITE,
-						e.second.readAll ? 0 : (globalOffset * e.second.elementSize * e.second.elementsPerThread + offsetElement * e.second.elementSize * e.second.elementsPerThread),
-						e.second.readAll ? (e.second.elementSize * e.second.n) : (numElement * e.second.elementSize * e.second.elementsPerThread),
-						nullptr,
+						offsetBytes,
+						sizeBytes,
 						nullptr,
+						&uploadEvents.back(),
 						&op
 					);
 
@@ -91,25 +178,42 @@ namespace GPGPU_LIB
 						throw std::invalid_argument(std::string("enqueueMapBuffer(write) error: ") + getErrorString(op));
 					}
 
-					op = queue.enqueueUnmapMemObject(e.second.buffer, ptrMap, NULL, NULL);
+					uploadEvents.emplace_back();
+					op = queue.enqueueUnmapMemObject(e.second.buffer, ptrMap, NULL, &uploadEvents.back());
 					if (op != CL_SUCCESS)
 					{
 						throw std::invalid_argument(std::string("enqueueUnmapMemObject(write) error: ") + getErrorString(op));
 					}
+					if (!e.second.writeOp)
+						e.second.resident->uploads[this] = uploadEvents.back();
 				}
 			}
 
 		}
+
+		if (!pendingUploads.empty())
+			waitFor(pendingUploads);
 	}
 
-	void CommandQueue::copyOutputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement)
+	void CommandQueue::copyOutputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement, bool includeWholeArrays)
 	{
+		// resident parameters are not copied, device only remembers which range it computed
+		for (auto& e : kernel.mapParameterIdToParameter)
+		{
+			if (e.second.residentOp && numElement > 0)
+			{
+				const size_t offsetBytes = (globalOffset + offsetElement) * e.second.elementSize * e.second.elementsPerThread;
+				e.second.recordWrite(offsetBytes, offsetBytes + numElement * e.second.elementSize * e.second.elementsPerThread);
+			}
+		}
+
 		if (!sharesRAM)
 		{
-			for (auto& e : kernel.mapParameterNameToParameter)
+			for (auto& e : kernel.mapParameterIdToParameter)
 			{			
-				if (e.second.writeOp)
+				if (e.second.writeOp && !e.second.tiles && (e.second.writeAll ? includeWholeArrays : numElement > 0))
 				{
+					downloadEvents.emplace_back();
 					cl_int op = queue.enqueueReadBuffer(
 						e.second.buffer,
 						CL_FALSE,
@@ -118,7 +222,9 @@ namespace GPGPU_LIB
 						e.second.hostPrm.quickPtr +
 						(
 							(globalOffset * e.second.elementSize * e.second.elementsPerThread + offsetElement * e.second.elementSize * e.second.elementsPerThread)
-							)
+							),
+						nullptr,
+						&downloadEvents.back()
 					);
 					if (op != CL_SUCCESS)
 					{
@@ -132,13 +238,14 @@ namespace GPGPU_LIB
 		}
 		else
 		{
-			for (auto& e : kernel.mapParameterNameToParameter)
+			for (auto& e : kernel.mapParameterIdToParameter)
 			{
 
-				if (e.second.writeOp)
+				if (e.second.writeOp && !e.second.tiles && (e.second.writeAll ? includeWholeArrays : numElement > 0))
 				{
 
 					cl_int op;
+					downloadEvents.emplace_back();
 					void* ptrMap = queue.enqueueMapBuffer(
 						e.second.buffer,
 						CL_FALSE,
@@ -146,7 +253,7 @@ namespace GPGPU_LIB
 						e.second.writeAll?0:(globalOffset * e.second.elementSize * e.second.elementsPerThread + offsetElement * e.second.elementSize * e.second.elementsPerThread),
 						e.second.writeAll?(e.second.elementSize * e.second.n):(numElement * e.second.elementSize * e.second.elementsPerThread),
 						nullptr,
-						nullptr,
+						&downloadEvents.back(),
 						&op
 					);
 
@@ -155,7 +262,8 @@ namespace GPGPU_LIB
 						throw std::invalid_argument(std::string("enqueueMapBuffer(read) error: ") + getErrorString(op));
 					}
 
-					op = queue.enqueueUnmapMemObject(e.second.buffer, ptrMap, NULL, NULL);
+					downloadEvents.emplace_back();
+					op = queue.enqueueUnmapMemObject(e.second.buffer, ptrMap, NULL, &downloadEvents.back());
 					if (op != CL_SUCCESS)
 					{
 						throw std::invalid_argument(std::string("enqueueUnmapMemObject(read) error: ") + getErrorString(op));
@@ -165,6 +273,197 @@ namespace GPGPU_LIB
 		}
 	}
 
+	void CommandQueue::bindTileSlots(Kernel& kernel, const cl::Context& context, size_t numElement, int slot)
+	{
+		for (auto& e : kernel.tileArgumentPositions)
+		{
+			Parameter& prm = kernel.mapParameterIdToParameter[e.first];
+			TileData& tiles = *prm.tiles;
+			const size_t tileBytes = numElement * prm.elementSize * prm.elementsPerThread;
+			if (tiles.slotBytes[slot] < tileBytes)
+			{
+				// commands of previous tiles keep old buffer alive until they complete
+				cl_int op;
+				tiles.slots[slot] = cl::Buffer(context, CL_MEM_READ_WRITE, tileBytes, nullptr, &op);
+				if (op != CL_SUCCESS)
+				{
+					throw std::invalid_argument(std::string("tile buffer allocation error: ") + getErrorString(op) + " (" + prm.name + ")");
+				}
+				tiles.slotBytes[slot] = tileBytes;
+			}
+
+			cl_int op = kernel.kernel.setArg(e.second, tiles.slots[slot]);
+			if (op != CL_SUCCESS)
+			{
+				throw std::invalid_argument(std::string("setArg(tile) error: ") + getErrorString(op));
+			}
+		}
+	}
+
+	void CommandQueue::copyTileInputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement, int slot)
+	{
+		for (auto& e : kernel.tileArgumentPositions)
+		{
+			Parameter& prm = kernel.mapParameterIdToParameter[e.first];
+			if (!prm.readOp)
+				continue;
+
+			const size_t bytesPerThread = prm.elementSize * prm.elementsPerThread;
+			uploadEvents.emplace_back();
+			cl_int op = queue.enqueueWriteBuffer(prm.tiles->slots[slot], CL_FALSE, 0, numElement * bytesPerThread, prm.hostPrm.quickPtr + (globalOffset + offsetElement) * bytesPerThread, nullptr, &uploadEvents.back());
+			if (op != CL_SUCCESS)
+			{
+				throw std::invalid_argument(std::string("enqueueWriteBuffer(tile) error: ") + getErrorString(op));
+			}
+		}
+	}
+
+	void CommandQueue::copyTileOutputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement, int slot)
+	{
+		for (auto& e : kernel.tileArgumentPositions)
+		{
+			Parameter& prm = kernel.mapParameterIdToParameter[e.first];
+			if (!prm.writeOp)
+				continue;
+
+			const size_t bytesPerThread = prm.elementSize * prm.elementsPerThread;
+			downloadEvents.emplace_back();
+			cl_int op = queue.enqueueReadBuffer(prm.tiles->slots[slot], CL_FALSE, 0, numElement * bytesPerThread, prm.hostPrm.quickPtr + (globalOffset + offsetElement) * bytesPerThread, nullptr, &downloadEvents.back());
+			if (op != CL_SUCCESS)
+			{
+				throw std::invalid_argument(std::string("enqueueReadBuffer(tile) error: ") + getErrorString(op));
+			}
+		}
+	}
+
+	void CommandQueue::readRange(Parameter& prm, size_t offsetBytes, size_t sizeBytes)
+	{
+		cl_int op;
+		if (!sharesRAM)
+		{
+			op = queue.enqueueReadBuffer(prm.buffer, CL_TRUE, offsetBytes, sizeBytes, prm.hostPrm.quickPtr + offsetBytes);
+			if (op != CL_SUCCESS)
+			{
+				throw std::invalid_argument(std::string("enqueueReadBuffer(resident) error: ") + getErrorString(op));
+			}
+			return;
+		}
+
+		void* ptrMap = queue.enqueueMapBuffer(prm.buffer, CL_TRUE, CL_MAP_READ, offsetBytes, sizeBytes, nullptr, nullptr, &op);
+		if (op != CL_SUCCESS)
+		{
+			throw std::invalid_argument(std::string("enqueueMapBuffer(resident read) error: ") + getErrorString(op));
+		}
+
+		op = queue.enqueueUnmapMemObject(prm.buffer, ptrMap);
+		if (op != CL_SUCCESS)
+		{
+			throw std::invalid_argument(std::string("enqueueUnmapMemObject(resident read) error: ") + getErrorString(op));
+		}
+		sync();
+	}
+
+	void CommandQueue::writeRange(Parameter& prm, size_t offsetBytes, size_t sizeBytes)
+	{
+		cl_int op;
+		if (!sharesRAM)
+		{
+			op = queue.enqueueWriteBuffer(prm.buffer, CL_TRUE, offsetBytes, sizeBytes, prm.hostPrm.quickPtr + offsetBytes);
+			if (op != CL_SUCCESS)
+			{
+				throw std::invalid_argument(std::string("enqueueWriteBuffer(resident) error: ") + getErrorString(op));
+			}
+			return;
+		}
+
+		void* ptrMap = queue.enqueueMapBuffer(prm.buffer, CL_TRUE, CL_MAP_WRITE, offsetBytes, sizeBytes, nullptr, nullptr, &op);
+		if (op != CL_SUCCESS)
+		{
+			throw std::invalid_argument(std::string("enqueueMapBuffer(resident write) error: ") + getErrorString(op));
+		}
+
+		op = queue.enqueueUnmapMemObject(prm.buffer, ptrMap);
+		if (op != CL_SUCCESS)
+		{
+			throw std::invalid_argument(std::string("enqueueUnmapMemObject(resident write) error: ") + getErrorString(op));
+		}
+		sync();
+	}
+
+	void CommandQueue::resetDeviceResults(Kernel& kernel)
+	{
+		for (auto& e : kernel.mapParameterIdToParameter)
+		{
+			if (e.second.reduction)
+			{
+				ReductionData& reduction = *e.second.reduction;
+				cl_int op = queue.enqueueWriteBuffer(e.second.buffer, CL_FALSE, 0, reduction.identity.size(), reduction.identity.data());
+				if (op != CL_SUCCESS)
+				{
+					throw std::invalid_argument(std::string("enqueueWriteBuffer(reduction) error: ") + getErrorString(op));
+				}
+			}
+
+			if (e.second.append)
+			{
+				auto counter = kernel.mapParameterIdToParameter.find(e.second.append->counterId);
+				if (counter == kernel.mapParameterIdToParameter.end())
+				{
+					throw std::invalid_argument(std::string("append buffer is bound without its counter: ") + e.second.name);
+				}
+
+				cl_uint zero = 0;
+				cl_int op = queue.enqueueFillBuffer(counter->second.buffer, zero, 0, sizeof(cl_uint));
+				if (op != CL_SUCCESS)
+				{
+					throw std::invalid_argument(std::string("enqueueFillBuffer(append counter) error: ") + getErrorString(op));
+				}
+			}
+		}
+	}
+
+	void CommandQueue::downloadDeviceResults(Kernel& kernel)
+	{
+		for (auto& e : kernel.mapParameterIdToParameter)
+		{
+			if (e.second.reduction)
+			{
+				ReductionData& reduction = *e.second.reduction;
+				cl_int op = queue.enqueueReadBuffer(e.second.buffer, CL_TRUE, 0, reduction.partial.size(), reduction.partial.data());
+				if (op != CL_SUCCESS)
+				{
+					throw std::invalid_argument(std::string("enqueueReadBuffer(reduction) error: ") + getErrorString(op));
+				}
+				reduction.ready = true;
+			}
+
+			if (e.second.append)
+			{
+				AppendData& append = *e.second.append;
+				cl_uint count = 0;
+				cl_int op = queue.enqueueReadBuffer(kernel.mapParameterIdToParameter[append.counterId].buffer, CL_TRUE, 0, sizeof(cl_uint), &count);
+				if (op != CL_SUCCESS)
+				{
+					throw std::invalid_argument(std::string("enqueueReadBuffer(append counter) error: ") + getErrorString(op));
+				}
+
+				// counter keeps counting after buffer is full (kernel skips writing those elements)
+				append.requested = count;
+				append.count = std::min((size_t)count, e.second.n);
+				append.staging.resize(append.count * e.second.elementSize);
+				if (append.count > 0)
+				{
+					op = queue.enqueueReadBuffer(e.second.buffer, CL_TRUE, 0, append.staging.size(), append.staging.data());
+					if (op != CL_SUCCESS)
+					{
+						throw std::invalid_argument(std::string("enqueueReadBuffer(append) error: ") + getErrorString(op));
+					}
+				}
+				append.ready = true;
+			}
+		}
+	}
+
 	void CommandQueue::flush()
 	{
 		cl_int op = queue.flush();
@@ -183,4 +482,46 @@ namespace GPGPU_LIB
 		}
 	}
 
+	double CommandQueue::sumOfDurations(std::vector<cl::Event>& events)
+	{
+		double total = 0;
+		for (auto& e : events)
+		{
+			cl_int op1, op2;
+			cl_ulong start = e.getProfilingInfo<CL_PROFILING_COMMAND_START>(&op1);
+			cl_ulong end = e.getProfilingInfo<CL_PROFILING_COMMAND_END>(&op2);
+			if (op1 == CL_SUCCESS && op2 == CL_SUCCESS && end > start)
+				total += (double)(end - start);
+		}
+		events.clear();
+		return total;
+	}
+
+	void CommandQueue::collectTimings(double& uploadNano, double& kernelNano, double& downloadNano)
+	{
+		uploadNano += sumOfDurations(uploadEvents);
+		kernelNano += sumOfDurations(kernelEvents);
+		downloadNano += sumOfDurations(downloadEvents);
+	}
+
+	void CommandQueue::waitFor(const std::vector<cl::Event>& events)
+	{
+		cl_int op = queue.enqueueBarrierWithWaitList(&events);
+		if (op != CL_SUCCESS)
+		{
+			throw std::invalid_argument(std::string("enqueueBarrierWithWaitList error: ") + getErrorString(op));
+		}
+	}
+
+	cl::Event CommandQueue::marker()
+	{
+		cl::Event event;
+		cl_int op = queue.enqueueMarkerWithWaitList(nullptr, &event);
+		if (op != CL_SUCCESS)
+		{
+			throw std::invalid_argument(std::string("enqueueMarkerWithWaitList error: ") + getErrorString(op));
+		}
+		return event;
+	}
+
 }
\ No newline at end of file
@@ -18,6 +18,11 @@ namespace GPGPU_LIB
 	{
 		cl::CommandQueue queue;
 		bool sharesRAM;
+
+		// profiling events of commands enqueued since last collectTimings() call
+		std::vector<cl::Event> uploadEvents;
+		std::vector<cl::Event> kernelEvents;
+		std::vector<cl::Event> downloadEvents;
 		// requires a context to build
 		CommandQueue(Context con = Context());
 
@@ -27,17 +32,58 @@ namespace GPGPU_LIB
 		// sets a parameter for kernel with position idx that is zero-based
 		void setPrm(Kernel& kernel, Parameter& prm, int idx);
 
+		// byte range of an input that a device needs for its work-items (whole array, or own region plus halo elements on both sides)
+		static void inputRange(Parameter& prm, size_t globalOffset, size_t offsetElement, size_t numElement, size_t& offsetBytes, size_t& sizeBytes);
+
+		// incomplete uploads that other queues of same device enqueued for the range of an input this queue skips (next commands must wait for them)
+		void pendingUploadsOfOtherQueues(Parameter& prm, std::vector<cl::Event>& events) const;
+
 		// copies (or no-copies for RAM-sharing devices) input buffers of kernel to devices from RAM
-		void copyInputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement);
+		// includeWholeArrays=false skips parameters that are copied as a whole (readAll), for all chunks but first chunk of a range
+		// an input that is skipped because another queue (a stream batch) is still uploading it makes next commands on this queue wait for that upload
+		void copyInputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement, bool includeWholeArrays = true);
 
 		// copies (or no-copies for RAM-sharing devices) output buffers of kernel from devices to RAM
-		void copyOutputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement);
+		// includeWholeArrays=false skips parameters that are copied as a whole (writeAll), for all chunks but last chunk of a range
+		// numElement=0 copies only whole arrays (after all chunks of a range are enqueued)
+		void copyOutputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement, bool includeWholeArrays = true);
+
+		// binds tile slot of each out-of-core parameter of kernel (allocating it for numElement work-items if it is smaller) to its argument position
+		void bindTileSlots(Kernel& kernel, const cl::Context& context, size_t numElement, int slot);
+
+		// copies regions of work-items [globalOffset + offsetElement, + numElement) of out-of-core inputs/outputs between host and beginning of their tile slot
+		void copyTileInputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement, int slot);
+		void copyTileOutputsOfKernel(Kernel& kernel, size_t globalOffset, size_t offsetElement, size_t numElement, int slot);
+
+		// blocking copies of bytes [offsetBytes, offsetBytes + sizeBytes) of a parameter between its device buffer and host data (map/unmap for RAM-sharing devices)
+		// for explicit synchronization of resident parameters
+		void readRange(Parameter& prm, size_t offsetBytes, size_t sizeBytes);
+		void writeRange(Parameter& prm, size_t offsetBytes, size_t sizeBytes);
+
+		// sets private copies of reduction parameters of kernel to identity values and counters of append buffers to zero (before first kernel of a run)
+		void resetDeviceResults(Kernel& kernel);
+
+		// downloads partial results of reduction parameters and used prefixes of append buffers of kernel, waits for them (after last kernel of a run)
+		void downloadDeviceResults(Kernel& kernel);
 
 		// starts pushing commands to device
 		void flush();
 
 		// waits for device to complete all commands on current queue
 		void sync();
+
+		// adds device-side durations (nanoseconds) of completed upload, kernel and download commands to given variables then forgets their events
+		// only valid after sync()
+		void collectTimings(double& uploadNano, double& kernelNano, double& downloadNano);
+
+		// makes next commands on this queue wait for given events (of other queues on same context)
+		void waitFor(const std::vector<cl::Event>& events);
+
+		// returns event of a marker that completes when all previous commands on this queue complete
+		cl::Event marker();
+
+		// sum of device-side durations (nanoseconds) of completed events, clears the list
+		static double sumOfDurations(std::vector<cl::Event>& events);
 	};
 }
 
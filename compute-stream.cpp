@@ -0,0 +1,258 @@
+#include "computer.h"
+
+namespace GPGPU
+{
+	StreamState::StreamState() :computer(nullptr), kernelId(-1), offsetElement(0), numGlobalThreads(0), numLocalThreads(0), nextSet(0)
+	{
+
+	}
+
+	void StreamState::waitBatch(int bufferSet)
+	{
+		if (!inFlight[bufferSet])
+			return;
+
+		const int n = batches[bufferSet].size();
+		std::vector<double> capability(n, 0.0);
+		double totalCapability = 0.0;
+		for (int i = 0; i < n; i++)
+		{
+			if (ranges[bufferSet][i] == 0)
+				continue;
+
+			GPGPU_LIB::GPGPUStreamBatch& batch = batches[bufferSet][i];
+			cl_int op = batch.completion.wait();
+			if (op != CL_SUCCESS)
+			{
+				throw std::invalid_argument(std::string("stream batch error: ") + getErrorString(op));
+			}
+
+			// stages of consecutive batches overlap so throughput of a device is bound by its slowest stage
+			const double upload = GPGPU_LIB::CommandQueue::sumOfDurations(batch.uploadEvents);
+			const double kernel = GPGPU_LIB::CommandQueue::sumOfDurations(batch.kernelEvents);
+			const double download = GPGPU_LIB::CommandQueue::sumOfDurations(batch.downloadEvents);
+			const double stage = std::max(upload, std::max(kernel, download));
+			if (stage > 0.0)
+			{
+				capability[i] = ranges[bufferSet][i] / stage;
+				totalCapability += capability[i];
+			}
+		}
+		inFlight[bufferSet] = false;
+
+		// only update when all devices were measured, a device without work (or without profiling data) would get zero share forever
+		for (int i = 0; i < n; i++)
+		{
+			if (capability[i] == 0.0)
+				return;
+		}
+
+		double norm = 0.0;
+		for (int i = 0; i < n; i++)
+		{
+			ratios[i] = 0.75 * ratios[i] + 0.25 * (capability[i] / totalCapability);
+			norm += ratios[i];
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			ratios[i] /= norm;
+		}
+	}
+
+	StreamState::~StreamState()
+	{
+		for (int i = 0; i < inFlight.size(); i++)
+		{
+			if (inFlight[i])
+			{
+				for (auto& batch : batches[i])
+				{
+					if (batch.completion())
+						batch.completion.wait();
+				}
+			}
+		}
+	}
+
+	ComputeStream::ComputeStream()
+	{
+
+	}
+
+	ComputeStream::ComputeStream(std::shared_ptr<StreamState> streamState) :state(streamState)
+	{
+
+	}
+
+	int ComputeStream::numBufferSets()
+	{
+		return state->parameters.size();
+	}
+
+	HostParameter ComputeStream::parameter(int bufferSet, std::string parameterName)
+	{
+		auto it = state->parameters[bufferSet].find(parameterName);
+		if (it == state->parameters[bufferSet].end())
+		{
+			throw std::invalid_argument(std::string("stream does not have parameter: ") + parameterName);
+		}
+		return it->second;
+	}
+
+	int ComputeStream::acquire()
+	{
+		const int bufferSet = state->nextSet;
+		state->nextSet = (bufferSet + 1) % state->parameters.size();
+		state->waitBatch(bufferSet);
+		return bufferSet;
+	}
+
+	void ComputeStream::submit(int bufferSet)
+	{
+		state->computer->submitStreamBatch(*state, bufferSet);
+	}
+
+	void ComputeStream::finish()
+	{
+		for (int i = 0; i < state->parameters.size(); i++)
+		{
+			state->waitBatch(i);
+		}
+	}
+
+	std::vector<double> ComputeStream::ratios()
+	{
+		return state->ratios;
+	}
+
+	ComputeStream Computer::createStream(
+		GPGPU::HostParameter prm,
+		std::string kernelName,
+		size_t offsetElement,
+		size_t numGlobalThreads,
+		size_t numLocalThreads,
+		int numBufferSets)
+	{
+		finishPendingCompute();
+		if (numBufferSets < 1)
+		{
+			throw std::invalid_argument("stream needs at least 1 buffer set");
+		}
+
+		const int n = workers.size();
+		const std::string streamName = std::string("#stream") + std::to_string(numStreams++);
+		std::shared_ptr<StreamState> stream = std::make_shared<StreamState>();
+		stream->computer = this;
+		stream->kernelId = kernelIdOf(kernelName);
+		stream->offsetElement = offsetElement;
+		stream->numGlobalThreads = numGlobalThreads;
+		stream->numLocalThreads = numLocalThreads;
+		stream->batches = std::vector<std::vector<GPGPU_LIB::GPGPUStreamBatch>>(numBufferSets, std::vector<GPGPU_LIB::GPGPUStreamBatch>(n));
+		stream->ranges = std::vector<std::vector<size_t>>(numBufferSets, std::vector<size_t>(n, 0));
+		stream->inFlight = std::vector<bool>(numBufferSets, false);
+
+		for (int set = 0; set < numBufferSets; set++)
+		{
+			const std::string setName = streamName + "#" + std::to_string(set);
+			const std::string clone = kernelName + setName;
+			const int cloneId = createKernelId(clone);
+			for (int i = 0; i < n; i++)
+			{
+				workers[i]->cloneKernel(stream->kernelId, cloneId);
+			}
+
+			std::map<std::string, HostParameter> setParameters;
+			for (int j = 0; j < prm.prmList.size(); j++)
+			{
+				const std::string& name = prm.prmList[j];
+				auto it = hostParameters.find(name);
+				if (it == hostParameters.end())
+				{
+					throw std::invalid_argument(std::string("parameter not found: ") + name);
+				}
+
+				if (it->second.isOutOfCore())
+				{
+					throw std::invalid_argument(std::string("out-of-core parameter can not be streamed: ") + name);
+				}
+
+				// batches do not reset, download or merge private copies of devices
+				if (it->second.isReduction())
+				{
+					throw std::invalid_argument(std::string("reduction parameter can not be streamed: ") + name);
+				}
+
+				// counters of append buffers are not reset by batches
+				if (it->second.isAppend() || it->second.isAppendCounter())
+				{
+					throw std::invalid_argument(std::string("append buffer can not be streamed: ") + name);
+				}
+
+				// work split of batches changes while other batches are in flight, so devices can not exchange their ranges
+				if (it->second.isResident())
+				{
+					throw std::invalid_argument(std::string("resident parameter can not be streamed: ") + name);
+				}
+
+				std::string boundName = name;
+				if (set > 0 && (it->second.readOp || it->second.writeOp))
+				{
+					boundName = name + setName;
+					hostParameters[boundName] = it->second.duplicate(boundName);
+					registerHostParameter(boundName);
+				}
+				setParameters[name] = hostParameters[boundName];
+				setKernelParameter(clone, boundName, j);
+			}
+			stream->parameters.push_back(setParameters);
+			stream->kernelClones.push_back(cloneId);
+		}
+
+		// start from what run() learned for this size
+		stream->ratios = bucketCapabilities(stream->kernelId, sizeBucket(numGlobalThreads));
+		double norm = 0.0;
+		for (int i = 0; i < n; i++)
+		{
+			norm += stream->ratios[i];
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			stream->ratios[i] /= norm;
+		}
+		return ComputeStream(stream);
+	}
+
+	void Computer::submitStreamBatch(StreamState& stream, int bufferSet)
+	{
+		finishPendingCompute();
+		if (stream.inFlight[bufferSet])
+		{
+			throw std::invalid_argument("buffer set is still in flight, acquire() it before submitting again");
+		}
+
+		const int n = workers.size();
+		excludedDevices.assign(n, false);
+		distributeRanges(stream.kernelId, stream.ratios, stream.numGlobalThreads, stream.numLocalThreads);
+		stream.ranges[bufferSet] = ranges;
+
+		for (int i = 0; i < n; i++)
+		{
+			if (ranges[i] > 0)
+			{
+				workers[i]->stream(stream.kernelClones[bufferSet], stream.offsetElement, offsets[i], ranges[i], stream.numLocalThreads, &stream.batches[bufferSet][i]);
+			}
+		}
+
+		// workers only enqueue commands so this does not wait for devices
+		for (int i = 0; i < n; i++)
+		{
+			if (ranges[i] > 0)
+			{
+				workers[i]->waitAllTasks();
+			}
+		}
+		stream.inFlight[bufferSet] = true;
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef GPGPU_COMPUTE_STREAM_LIB
+#define GPGPU_COMPUTE_STREAM_LIB
+
+#include "gpgpu_init.hpp"
+#include "parameter.h"
+#include "task-queue.h"
+#include <map>
+#include <memory>
+#include <vector>
+namespace GPGPU
+{
+	struct Computer;
+
+	// buffer sets and in-flight batches of a ComputeStream
+	struct StreamState
+	{
+		Computer* computer;
+		int kernelId;
+		size_t offsetElement;
+		size_t numGlobalThreads;
+		size_t numLocalThreads;
+
+		// buffer set to be returned by next acquire()
+		int nextSet;
+
+		// per buffer set: host parameters (by name of original parameter), kernel clone that is bound to them, ranges of devices in its last batch, whether its batch is not waited yet
+		std::vector<std::map<std::string, HostParameter>> parameters;
+		std::vector<int> kernelClones;
+		std::vector<std::vector<size_t>> ranges;
+		std::vector<bool> inFlight;
+
+		// per buffer set per device, written by workers when commands are enqueued
+		std::vector<std::vector<GPGPU_LIB::GPGPUStreamBatch>> batches;
+
+		// workload ratios of devices, updated from device-side durations of completed batches
+		std::vector<double> ratios;
+
+		StreamState();
+
+		// blocks until batch of a buffer set is downloaded and updates ratios from its durations
+		void waitBatch(int bufferSet);
+
+		// waits all batches in flight (buffers of devices must not be released while they are used)
+		~StreamState();
+	};
+
+	/*
+		pipeline of repeated compute calls of same kernel with same size (Computer::createStream)
+		each buffer set has its own copy of input/output parameters on host and on devices
+		upload of batch k+1, kernel of batch k and download of batch k-1 overlap on each device because they use separate command queues
+
+		usage:
+			int set = stream.acquire();                     // waits until set is free (its previous batch is downloaded)
+			stream.parameter(set, "a").access<float>(i) ... // reads outputs of previous batch, writes inputs of next batch
+			stream.submit(set);                             // returns without waiting devices
+
+		the stream must be destroyed (or finish() called) before its Computer
+	*/
+	struct ComputeStream
+	{
+		friend struct Computer;
+	private:
+		std::shared_ptr<StreamState> state;
+		ComputeStream(std::shared_ptr<StreamState> streamState);
+	public:
+		ComputeStream();
+
+		int numBufferSets();
+
+		// host side of a parameter in a buffer set. buffer set 0 uses the original parameters, state parameters (not input nor output) are shared by all sets
+		HostParameter parameter(int bufferSet, std::string parameterName);
+
+		// waits until next buffer set (in round-robin order) is not used by devices anymore and returns its index
+		int acquire();
+
+		// starts upload, compute and download of a buffer set on all devices without waiting
+		void submit(int bufferSet);
+
+		// waits all submitted batches
+		void finish();
+
+		// workload ratios of devices (on the same order their names appear on deviceNames())
+		std::vector<double> ratios();
+	};
+}
+#endif // !GPGPU_COMPUTE_STREAM_LIB
@@ -1,10 +1,60 @@
 #include "computer.h"
+#include "host-memory.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <tuple>
 
 namespace GPGPU
 {
+	// FNV-1a hash, unlike std::hash it gives same value in every process (required for load-balance profiles)
+	static uint64_t hashString(const std::string& str)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (unsigned char c : str)
+		{
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static const int loadBalanceProfileVersion = 3;
+
+	static void writeValues(std::ostream& file, const char* tag, const std::vector<double>& values)
+	{
+		file << tag << " " << values.size();
+		for (auto& v : values)
+			file << " " << v;
+		file << "\n";
+	}
+
+	static std::vector<double> readValues(std::istream& file, const char* tag, const std::string& fileName)
+	{
+		std::string token;
+		size_t count = 0;
+		file >> token >> count;
+		if (!file || token != tag)
+		{
+			throw std::invalid_argument(std::string("error: corrupt load-balance profile (expected ") + tag + "): " + fileName);
+		}
+		std::vector<double> values(count);
+		for (size_t i = 0; i < count; i++)
+			file >> values[i];
+		return values;
+	}
+
 	Computer::Computer(int deviceSelection, int selectionIndex, int clonesPerDevice, bool giveDirectRamAccessToCPU, int maxDevices)
 	{
 
+		loadBalancingMode = LOAD_BALANCE_RATIO;
+		fineGrainedScheduler = FINE_GRAIN_SHARED_QUEUE;
+		deviceExclusion = false;
+		reprobeInterval = 0;
+		numStreams = 0;
+		overlapChunks = 1;
+		fineGrainedPipelineDepth = 2;
+		pinnedWorker = -1;
 		std::vector<GPGPU_LIB::Device> allGPUs = platform.getDevices(CL_DEVICE_TYPE_GPU);
 		std::vector<GPGPU_LIB::Device> allACCs = platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR);
 
@@ -104,24 +154,197 @@ namespace GPGPU
 		}
 	}
 
+	Computer::~Computer()
+	{
+		finishPendingCompute();
+	}
+
 	int Computer::getNumDevices()
 	{
 		return workers.size();
 	}
 
-	void Computer::compile(std::string kernelCode, std::string kernelName)
+	int Computer::compile(std::string kernelCode, std::string kernelName)
+	{
+		finishPendingCompute();
+		const int id = createKernelId(kernelName);
+		kernelSourceHashes[kernelName] = hashString(kernelCode);
+		for (int i = 0; i < workers.size(); i++)
+		{
+			workers[i]->compile(kernelCode, kernelName, id, &compileLock);
+		}
+		return id;
+	}
+
+	int Computer::createKernelId(const std::string& kernelName)
+	{
+		auto it = kernelIds.find(kernelName);
+		if (it != kernelIds.end())
+			return it->second;
+
+		const int id = kernelNamesOfIds.size();
+		kernelIds[kernelName] = id;
+		kernelNamesOfIds.push_back(kernelName);
+		balanceStates.emplace_back();
+		costSamples.emplace_back(workers.size());
+		launchCounts.push_back(0);
+		bindingVersions.push_back(0);
+		boundParameterIds.emplace_back();
+		residentBindings.push_back(0);
+		outOfCoreBindings.push_back(0);
+		for (int i = 0; i < workers.size(); i++)
+		{
+			workers[i]->addBalanceKey(id);
+		}
+		return id;
+	}
+
+	int Computer::kernelIdOf(const std::string& kernelName)
+	{
+		auto it = kernelIds.find(kernelName);
+		if (it == kernelIds.end())
+		{
+			throw std::invalid_argument(std::string("error: kernel is not compiled: ") + kernelName);
+		}
+		return it->second;
+	}
+
+	void Computer::registerHostParameter(const std::string& parameterName)
 	{
+		auto it = parameterIds.find(parameterName);
+		if (it == parameterIds.end())
+		{
+			it = parameterIds.emplace(parameterName, (int)parameterIds.size()).first;
+			parameterNamesOfIds.push_back(parameterName);
+		}
+
+		HostParameter& parameter = hostParameters[parameterName];
+		parameter.id = it->second;
 		for (int i = 0; i < workers.size(); i++)
 		{
-			workers[i]->compile(kernelCode, kernelName, &compileLock);
+			workers[i]->mirror(&parameter);
+		}
+	}
+
+
+
+	void Computer::setLoadBalancingMode(int mode)
+	{
+		if (mode != LOAD_BALANCE_RATIO && mode != LOAD_BALANCE_AFFINE)
+		{
+			throw std::invalid_argument(std::string("error: unknown load-balancing mode: ") + std::to_string(mode));
+		}
+		loadBalancingMode = mode;
+	}
+
+	void Computer::setFineGrainedScheduler(int scheduler)
+	{
+		if (scheduler != FINE_GRAIN_SHARED_QUEUE && scheduler != FINE_GRAIN_WORK_STEALING && scheduler != FINE_GRAIN_GUIDED)
+		{
+			throw std::invalid_argument(std::string("error: unknown fine-grained scheduler: ") + std::to_string(scheduler));
+		}
+		fineGrainedScheduler = scheduler;
+	}
+
+	void Computer::setDeviceExclusion(bool enabled, int reprobeEveryNthRun)
+	{
+		deviceExclusion = enabled;
+		reprobeInterval = reprobeEveryNthRun;
+	}
+
+	void Computer::setOverlapChunks(int chunksPerDevice)
+	{
+		overlapChunks = std::max(1, chunksPerDevice);
+	}
+
+	void Computer::setFineGrainedPipelineDepth(int chunksInFlight)
+	{
+		fineGrainedPipelineDepth = std::max(1, chunksInFlight);
+	}
+
+	void Computer::setHostMemoryOptions(bool prefault, size_t maxCachedBytes)
+	{
+		std::shared_ptr<GPGPU_LIB::HostMemoryPool> pool = GPGPU_LIB::HostMemoryPool::instance();
+		pool->setPrefault(prefault);
+		pool->setCacheLimit(maxCachedBytes);
+	}
+
+	void Computer::setHostMemoryPolicy(int hugePages, int numaPolicy, int numaNode)
+	{
+		if (hugePages < HOST_HUGE_PAGES_NONE || hugePages > HOST_HUGE_PAGES_EXPLICIT)
+		{
+			throw std::invalid_argument(std::string("error: unknown huge page mode: ") + std::to_string(hugePages));
+		}
+
+		if (numaPolicy < HOST_NUMA_DEFAULT || numaPolicy > HOST_NUMA_SPLIT_BY_DEVICES)
+		{
+			throw std::invalid_argument(std::string("error: unknown NUMA policy: ") + std::to_string(numaPolicy));
+		}
+
+		if (numaPolicy == HOST_NUMA_BIND && numaNode < 0)
+		{
+			throw std::invalid_argument(std::string("error: NUMA node can not be negative: ") + std::to_string(numaNode));
+		}
+
+		hostMemoryPolicy.hugePages = hugePages;
+		hostMemoryPolicy.numaPolicy = numaPolicy;
+		hostMemoryPolicy.numaNode = numaNode;
+		hostMemoryPolicy.segments.clear();
+	}
+
+	const GPGPU_LIB::HostMemoryPolicy* Computer::memoryPolicyForNewParameter()
+	{
+		if (hostMemoryPolicy.isDefault())
+			return nullptr;
+
+		hostMemoryPolicy.segments.clear();
+		if (hostMemoryPolicy.numaPolicy == HOST_NUMA_SPLIT_BY_DEVICES)
+		{
+			const int n = workers.size();
+			size_t totalRange = 0;
+			for (int i = 0; i < ranges.size(); i++)
+				totalRange += ranges[i];
+
+			// devices take consecutive regions in worker order (same as distributeRanges)
+			double end = 0.0;
+			for (int i = 0; i < n; i++)
+			{
+				end += (totalRange > 0 && ranges.size() == n) ? (ranges[i] / (double)totalRange) : (1.0 / n);
+				hostMemoryPolicy.segments.push_back(std::make_pair(i == n - 1 ? 1.0 : end, workers[i]->context.device.numaNode));
+			}
 		}
+		return &hostMemoryPolicy;
 	}
 
+	void Computer::setPinnedHostMemory(bool enabled)
+	{
+		pinnedWorker = -1;
+		for (int i = 0; enabled && i < workers.size(); i++)
+		{
+			if (!workers[i]->context.device.sharesRAM)
+			{
+				pinnedWorker = i;
+				break;
+			}
+		}
+	}
 
+	const GPGPU_LIB::Context* Computer::pinnedContextForNewParameter()
+	{
+		return pinnedWorker < 0 ? nullptr : &workers[pinnedWorker]->context;
+	}
 
 	// binds a parameter to a kernel at parameterPosition-th position
 	void Computer::setKernelParameter(std::string kernelName, std::string parameterName, int parameterPosition)
 	{
+		finishPendingCompute();
+		const int kernelId = kernelIdOf(kernelName);
+		auto parameter = hostParameters.find(parameterName);
+		if (parameter == hostParameters.end())
+		{
+			throw std::invalid_argument(std::string("error: parameter not found: ") + parameterName);
+		}
+
 		// iterating 2 maps with several items should be faster than several threads to do something
 
 		std::map<std::string, std::map<std::string, int>>::iterator it1 = kernelParameters.find(kernelName);
@@ -180,269 +403,457 @@ namespace GPGPU
 
 		if (sendToThreads)
 		{
+			bindingVersions[kernelId]++;
+			recordBinding(kernelId, parameterPosition, parameter->second.id);
 			const int nWork = workers.size();
 			for (int i = 0; i < nWork; i++)
 			{
-				workers[i]->setArg(kernelName, parameterName, parameterPosition);
+				workers[i]->setArg(kernelId, parameter->second.id, parameterPosition);
 			}
 		}
 
 
 	}
 
-	// applies load-balancing inside each call
-	std::vector<double> Computer::runFineGrainedLoadBalancing(std::string kernelName, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads, size_t loadSize)
+	int Computer::residentParameterId(GPGPU::HostParameter& prm)
 	{
-		std::vector<double> performancesOfDevices(workers.size());
-
-		//std::cout << "debug 2.5" << std::endl;
-		std::shared_ptr<GPGPU_LIB::GPGPUTaskQueue> taskQueue = std::make_shared<GPGPU_LIB::GPGPUTaskQueue>();
-
-		//std::cout << "debug 4" << std::endl;
-		for (size_t i = 0; i < numGlobalThreads; i += loadSize)
+		auto it = hostParameters.find(prm.getName());
+		if (it == hostParameters.end())
 		{
-
-			GPGPU_LIB::GPGPUTask task;
-			task.taskType = GPGPU_LIB::GPGPUTask::GPGPU_TASK_COMPUTE;
-			task.kernelName = kernelName;
-			task.globalOffset = offsetElement;
-			task.offset = i;
-			task.globalSize = loadSize;
-			task.localSize = numLocalThreads;
-			taskQueue->push(task);
-
+			throw std::invalid_argument(std::string("error: parameter not found: ") + prm.getName());
 		}
-		//std::cout << "debug 5" << std::endl;
-		// compute kernels with balanced loads
-		//std::cout << "debug 1" << std::endl;
-		for (int i = 0; i < workers.size(); i++)
+
+		if (!it->second.isResident())
 		{
-			// mark end of queue for each worker
-			GPGPU_LIB::GPGPUTask task;
-			task.taskType = GPGPU_LIB::GPGPUTask::GPGPU_TASK_NULL;
-			taskQueue->push(task);
-			workers[i]->runTasks(taskQueue, kernelName);
+			throw std::invalid_argument(std::string("error: parameter is not resident: ") + prm.getName());
 		}
+		return it->second.id;
+	}
 
-		//std::cout << "debug 2" << std::endl;
-		//std::cout << "debug 6" << std::endl;
-		for (int i = 0; i < workers.size(); i++)
+	void Computer::recordBinding(int kernelId, int parameterPosition, int parameterId)
+	{
+		std::map<int, int>& bound = boundParameterIds[kernelId];
+		for (auto it = bound.begin(); it != bound.end();)
 		{
-			workers[i]->waitAllTasks();
+			if (it->second == parameterId && it->first != parameterPosition)
+				it = bound.erase(it);
+			else
+				++it;
 		}
-		//std::cout << "debug 3" << std::endl;
+		bound[parameterPosition] = parameterId;
 
-		double norm = 0.0;
-
-		for (int i = 0; i < workers.size(); i++)
+		residentBindings[kernelId] = 0;
+		outOfCoreBindings[kernelId] = 0;
+		for (auto& b : bound)
 		{
-			std::unique_lock<std::mutex> lock(workers[i]->commonSync);
+			auto it = hostParameters.find(parameterNamesOfIds[b.second]);
+			if (it != hostParameters.end() && it->second.isResident())
+				residentBindings[kernelId]++;
+			if (it != hostParameters.end() && it->second.isOutOfCore())
+				outOfCoreBindings[kernelId]++;
+		}
+	}
 
-			performancesOfDevices[i] = workers[i]->works[kernelName] / workers[i]->benchmarks[kernelName];
-			norm += performancesOfDevices[i];
+	std::map<size_t, std::pair<size_t, int>> Computer::residentOwners(int parameterId)
+	{
+		const int n = workers.size();
+		std::vector<std::pair<GPGPU_LIB::DeviceWrite, int>> writes;
+		for (int i = 0; i < n; i++)
+		{
+			for (auto& w : workers[i]->residentWrites(parameterId))
+				writes.push_back(std::make_pair(w, i));
 		}
+		std::sort(writes.begin(), writes.end(), [](const std::pair<GPGPU_LIB::DeviceWrite, int>& a, const std::pair<GPGPU_LIB::DeviceWrite, int>& b) { return a.first.stamp < b.first.stamp; });
 
-		for (int i = 0; i < workers.size(); i++)
+		// byte ranges with their last writer: begin --> (end, device)
+		std::map<size_t, std::pair<size_t, int>> owners;
+		for (auto& w : writes)
 		{
-			performancesOfDevices[i] /= norm;
+			const size_t begin = w.first.begin;
+			const size_t end = w.first.end;
+			auto it = owners.lower_bound(begin);
+			if (it != owners.begin())
+			{
+				auto prev = std::prev(it);
+				const size_t prevEnd = prev->second.first;
+				if (prevEnd > begin)
+				{
+					prev->second.first = begin;
+					if (prevEnd > end)
+						owners[end] = std::make_pair(prevEnd, prev->second.second);
+				}
+			}
+
+			while (it != owners.end() && it->first < end)
+			{
+				if (it->second.first > end)
+					owners[end] = it->second;
+				it = owners.erase(it);
+			}
+			owners[begin] = std::make_pair(end, w.second);
 		}
-		return performancesOfDevices;
+		return owners;
 	}
 
-
-	// applies load-balancing between calls
-	std::vector<double> Computer::run(std::string kernelName, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads)
+	void Computer::refreshResidentRanges(int kernelId, size_t offsetElement, const std::vector<size_t>& deviceOffsets, const std::vector<size_t>& deviceRanges)
 	{
+		if (residentBindings[kernelId] == 0)
+			return;
+
 		const int n = workers.size();
-		std::vector<double> nano(n);
-		if (loadBalances.find(kernelName) == loadBalances.end())
+		for (auto& bound : boundParameterIds[kernelId])
 		{
-			loadBalances[kernelName] = std::vector<double>(n, 1.0);
-		}
+			auto parameter = hostParameters.find(parameterNamesOfIds[bound.second]);
+			if (parameter == hostParameters.end() || !parameter->second.isResident())
+				continue;
+
+			const int id = bound.second;
+			const HostParameter& host = parameter->second;
+			const size_t bytesPerThread = host.elementSize * host.elementsPerThr;
+			const size_t arrayBytes = host.n * host.elementSize;
+			std::map<size_t, std::pair<size_t, int>> owners = residentOwners(id);
+			if (owners.empty())
+				continue;
+
+			// (receiver, begin, end) of parts that other devices wrote last, each part is downloaded once from its writer
+			std::vector<std::tuple<int, size_t, size_t>> transfers;
+			std::set<std::pair<size_t, size_t>> downloaded;
+			std::vector<int> numTasks(n, 0);
+			for (int i = 0; i < n; i++)
+			{
+				if (deviceRanges[i] == 0)
+					continue;
+
+				const size_t begin = std::min((offsetElement + deviceOffsets[i]) * bytesPerThread, arrayBytes);
+				const size_t end = std::min(begin + deviceRanges[i] * bytesPerThread, arrayBytes);
+				auto it = owners.upper_bound(begin);
+				if (it != owners.begin())
+					--it;
+				for (; it != owners.end() && it->first < end; ++it)
+				{
+					const size_t partBegin = std::max(begin, it->first);
+					const size_t partEnd = std::min(end, it->second.first);
+					const int writer = it->second.second;
+					if (partBegin >= partEnd || writer == i)
+						continue;
 
-		std::vector<double>& selectedKernelLB = loadBalances[kernelName];
+					if (downloaded.insert(std::make_pair(partBegin, partEnd)).second)
+					{
+						workers[writer]->downloadResident(id, partBegin, partEnd - partBegin);
 
+						// retire queue of a worker is bounded
+						if (++numTasks[writer] == 64)
+						{
+							workers[writer]->waitAllTasks();
+							numTasks[writer]--;
+						}
+					}
+					transfers.push_back(std::make_tuple(i, partBegin, partEnd));
+				}
+			}
 
-		// compute load-balancing
-		auto& oldLoadBalnc = oldLoadBalances[kernelName];
-		const int nlb = oldLoadBalnc.size();
-		double totalLoad = 0;
-		std::vector<double> avg(n, 0);
-		for (int i = 0; i < nlb; i++)
-		{
-			for (int j = 0; j < n; j++)
+			// uploads start after all downloads are on host
+			for (int i = 0; i < n; i++)
 			{
-				avg[j] += oldLoadBalnc[i][j];
+				for (; numTasks[i] > 0; numTasks[i]--)
+					workers[i]->waitAllTasks();
+			}
+
+			for (auto& transfer : transfers)
+			{
+				const int receiver = std::get<0>(transfer);
+				workers[receiver]->uploadResidentRange(id, std::get<1>(transfer), std::get<2>(transfer) - std::get<1>(transfer));
+				if (++numTasks[receiver] == 64)
+				{
+					workers[receiver]->waitAllTasks();
+					numTasks[receiver]--;
+				}
 			}
 
+			for (int i = 0; i < n; i++)
+			{
+				for (; numTasks[i] > 0; numTasks[i]--)
+					workers[i]->waitAllTasks();
+			}
 		}
+	}
 
-		for (int i = 0; i < n; i++)
-		{
-			std::unique_lock<std::mutex> lock(workers[i]->commonSync);
-			nano[i] = workers[i]->benchmarks[kernelName];
+	void Computer::syncToHost(GPGPU::HostParameter prm)
+	{
+		finishPendingCompute();
+		const int id = residentParameterId(prm);
+		const int n = workers.size();
+		std::map<size_t, std::pair<size_t, int>> owners = residentOwners(id);
 
+		// neighboring ranges of same device are downloaded together
+		std::vector<int> numTasks(n, 0);
+		for (auto it = owners.begin(); it != owners.end();)
+		{
+			const size_t begin = it->first;
+			size_t end = it->second.first;
+			const int device = it->second.second;
+			for (++it; it != owners.end() && it->first == end && it->second.second == device; ++it)
+				end = it->second.first;
+			workers[device]->downloadResident(id, begin, end - begin);
+
+			// retire queue of a worker is bounded, many scattered ranges (fine-grained runs) are retired while being downloaded
+			if (++numTasks[device] == 64)
+			{
+				workers[device]->waitAllTasks();
+				numTasks[device]--;
+			}
 		}
 
+		// each task retires separately
 		for (int i = 0; i < n; i++)
 		{
-			nano[i] = ranges[i] / nano[i]; // capability = run_size / run_time
-			nano[i] = (avg[i] + (nano[i] * 4)) / (nlb + 4);
-			totalLoad += nano[i];
+			for (int j = 0; j < numTasks[i]; j++)
+				workers[i]->waitAllTasks();
 		}
+	}
 
-		// normalized loads
-		for (int i = 0; i < n; i++)
+	void Computer::mergeReductions()
+	{
+		for (int id : reductionParameterIds)
 		{
-			avg[i] = nano[i];
-			selectedKernelLB[i] = nano[i] / totalLoad;
+			// same name may be re-created as another kind of parameter
+			const std::string& name = parameterNamesOfIds[id];
+			auto it = hostParameters.find(name);
+			if (it == hostParameters.end() || !it->second.isReduction())
+				continue;
+
+			HostParameter& host = it->second;
+			bool first = true;
+			for (auto& worker : workers)
+			{
+				const int8_t* partial = worker->takeReductionPartial(id);
+				if (partial == nullptr)
+					continue;
+
+				if (first)
+					std::copy(partial, partial + host.n * host.elementSize, host.quickPtr);
+				else
+					host.reductionCombiner(host.quickPtr, partial, host.n);
+				first = false;
+			}
 		}
+	}
 
-		for (int i = 0; i < nlb - 1; i++)
+	void Computer::mergeAppends()
+	{
+		for (int id : appendParameterIds)
 		{
-			oldLoadBalnc[i] = oldLoadBalnc[i + 1];
+			const std::string& name = parameterNamesOfIds[id];
+			auto it = hostParameters.find(name);
+			if (it == hostParameters.end() || !it->second.isAppend())
+				continue;
+
+			HostParameter& host = it->second;
+			std::vector<size_t> counts(workers.size(), 0);
+			std::vector<size_t> requests(workers.size(), 0);
+			size_t total = 0;
+			bool any = false;
+			for (int i = 0; i < workers.size(); i++)
+			{
+				GPGPU_LIB::AppendData* append = workers[i]->takeAppendResult(id);
+				if (append == nullptr)
+					continue;
+
+				requests[i] = append->requested;
+				counts[i] = std::min(append->count, host.n - total);
+				std::copy(append->staging.begin(), append->staging.begin() + counts[i] * host.elementSize, host.quickPtr + total * host.elementSize);
+				total += counts[i];
+				any = true;
+			}
+
+			if (any)
+			{
+				appendCountsOfIds[id] = counts;
+				appendRequestsOfIds[id] = requests;
+			}
 		}
+	}
 
-		if (oldLoadBalnc.size() > 1)
-			oldLoadBalnc.resize(1);
+	void Computer::mergeDeviceResults()
+	{
+		if (!reductionParameterIds.empty())
+			mergeReductions();
+		if (!appendParameterIds.empty())
+			mergeAppends();
+	}
 
-		// calculate ranges
-		for (int i = 0; i < n; i++)
+	std::vector<size_t> Computer::getAppendCounts(GPGPU::HostParameter prm, bool requested)
+	{
+		finishPendingCompute();
+		auto it = hostParameters.find(prm.getName());
+		if (it == hostParameters.end() || !it->second.isAppend())
 		{
-			ranges[i] = (((size_t)(numGlobalThreads * selectedKernelLB[i])) / numLocalThreads) * numLocalThreads;
+			throw std::invalid_argument(std::string("error: parameter is not an append buffer: ") + prm.getName());
 		}
 
-		size_t totalThreads = 0;
+		std::map<int, std::vector<size_t>>& countsOfIds = requested ? appendRequestsOfIds : appendCountsOfIds;
+		auto counts = countsOfIds.find(it->second.id);
+		if (counts == countsOfIds.end())
+			return std::vector<size_t>(workers.size(), 0);
+		return counts->second;
+	}
 
-		// refine ranges (invalid values)
+	void Computer::syncToDevices(GPGPU::HostParameter prm)
+	{
+		finishPendingCompute();
+		const int id = residentParameterId(prm);
+		const int n = workers.size();
 		for (int i = 0; i < n; i++)
 		{
-			// if no work was given, give it at least single work group 
-			if (ranges[i] == 0)
-			{
-				ranges[i] = numLocalThreads;
-			}
-			totalThreads += ranges[i];
+			workers[i]->uploadResident(id);
 		}
 
-
-		size_t toBeSubtracted = 0;
-		size_t toBeAdded = 0;
-		// can not compute more threads than given
-		if (totalThreads > numGlobalThreads)
+		for (int i = 0; i < n; i++)
 		{
-			toBeSubtracted = totalThreads - numGlobalThreads;
+			workers[i]->waitAllTasks();
 		}
+	}
 
-		// can not compute more threads than given
-		if (totalThreads < numGlobalThreads)
-		{
-			toBeAdded = numGlobalThreads - totalThreads;
-		}
+	// applies load-balancing inside each call
+	std::vector<double> Computer::runFineGrainedLoadBalancing(std::string kernelName, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads, size_t loadSize)
+	{
+		finishPendingCompute();
+		return ComputeHandle(startFineGrainedLoadBalancing(kernelIdOf(kernelName), offsetElement, numGlobalThreads, numLocalThreads, loadSize)).wait();
+	}
 
-		// redistribute the remainder
-		// first devices tend to trade more of it, negligible when numGlobalThreads >> numLocalThreads
-		int tryCt = 0;
-		size_t newTotal = 0;
-		while (toBeSubtracted > 0 || toBeAdded > 0)
+	// gives chunks to all workers without waiting them
+	std::shared_ptr<ComputeState> Computer::startFineGrainedLoadBalancing(int kernelId, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads, size_t loadSize, bool outOfCore)
+	{
+		if (!outOfCore)
+			throwIfOutOfCore(kernelId);
+
+		const int n = workers.size();
+
+		// any device may take any chunk
+		refreshResidentRanges(kernelId, offsetElement, std::vector<size_t>(n, 0), std::vector<size_t>(n, numGlobalThreads));
+
+		std::shared_ptr<ComputeState> state = std::make_shared<ComputeState>();
+		state->workers = workers;
+		state->finalize = [this, kernelId](ComputeState& st) { st.ratios = throughputShares(kernelId); mergeDeviceResults(); };
+
+		// guided chunks are bigger than loadSize, tiles have to fit in tile slots
+		if (fineGrainedScheduler == FINE_GRAIN_GUIDED && !outOfCore)
 		{
-			if (tryCt++ > 10)
-				break;
+			// chunks are cut on demand
+			std::shared_ptr<GPGPU_LIB::GPGPUGuidedTaskQueue> guidedQueue = std::make_shared<GPGPU_LIB::GPGPUGuidedTaskQueue>(kernelId, offsetElement, numGlobalThreads, numLocalThreads, loadSize, throughputShares(kernelId));
+			state->chunkSource = guidedQueue;
 			for (int i = 0; i < n; i++)
 			{
-				if (toBeSubtracted > 0 && ranges[i] > numLocalThreads)
-				{
-					ranges[i] -= numLocalThreads;
-					toBeSubtracted -= numLocalThreads;
-				}
-
-				if (toBeAdded > 0)
-				{
-					ranges[i] += numLocalThreads;
-					toBeAdded -= numLocalThreads;
-				}
+				workers[i]->runTasks(guidedQueue.get(), i, kernelId, fineGrainedPipelineDepth);
 			}
+
+			return state;
 		}
 
+		std::vector<GPGPU_LIB::GPGPUTask> chunks;
+		for (size_t i = 0; i < numGlobalThreads; i += loadSize)
+		{
 
-		for (int i = 0; i < n; i++)
-			newTotal += ranges[i];
+			GPGPU_LIB::GPGPUTask task;
+			task.taskType = GPGPU_LIB::GPGPUTask::GPGPU_TASK_COMPUTE;
+			task.kernelId = kernelId;
+			task.globalOffset = offsetElement;
+			task.offset = i;
+			task.globalSize = std::min(loadSize, numGlobalThreads - i);
+			task.localSize = numLocalThreads;
+			chunks.push_back(task);
 
-		if (toBeSubtracted > 0 || toBeAdded > 0 || newTotal != numGlobalThreads || (newTotal / numLocalThreads) * numLocalThreads != newTotal)
+		}
+
+		if (fineGrainedScheduler == FINE_GRAIN_WORK_STEALING)
 		{
-			std::string err("error: load-balancing failed. check if there is enough number of local threads in global number of threads to share between all devices and global must be integer-multiple of local");
-			err += std::string(" \n  threads need to be subtracted =  ") + std::to_string(toBeSubtracted);
-			err += std::string(" \n  threads need to be added =  ") + std::to_string(toBeAdded);
-			err += std::string(" \n  total threads distributed =  ") + std::to_string(newTotal);
-			err += std::string(" \n  global threads required =  ") + std::to_string(numGlobalThreads);
+			std::shared_ptr<GPGPU_LIB::GPGPUWorkStealingQueue> stealingQueue = std::make_shared<GPGPU_LIB::GPGPUWorkStealingQueue>(n);
+			state->chunkSource = stealingQueue;
+
+			// each worker gets a contiguous block of chunks proportional to its last measured throughput so that stealing is only needed at the tail
+			std::vector<double> shares = throughputShares(kernelId);
+			const size_t nChunks = chunks.size();
+			double cumulativeShare = 0.0;
+			size_t firstChunk = 0;
 			for (int i = 0; i < n; i++)
 			{
-				err += std::string("\n performance of device = ");
-				err += std::to_string(workers[i]->benchmarks[kernelName]);
+				cumulativeShare += shares[i];
+				size_t lastChunk = (i == n - 1) ? nChunks : std::min(nChunks, (size_t)(nChunks * cumulativeShare + 0.5));
+				for (size_t c = firstChunk; c < lastChunk; c++)
+				{
+					stealingQueue->push(i, chunks[c]);
+				}
+				firstChunk = std::max(firstChunk, lastChunk);
 			}
-			throw std::invalid_argument(err);
-		}
-
 
-		// compute offsets
-		size_t curOfs = 0;
-		for (int i = 0; i < n; i++)
-		{
-			offsets[i] = curOfs;
-			curOfs += ranges[i];
+			for (int i = 0; i < n; i++)
+			{
+				workers[i]->runTasks(stealingQueue.get(), i, kernelId, fineGrainedPipelineDepth, outOfCore);
+			}
 		}
-
-		// compute kernels with balanced loads
-		for (int i = 0; i < n; i++)
+		else
 		{
+			// all chunks and end markers fit so that pushing never waits for workers
+			std::shared_ptr<GPGPU_LIB::GPGPUTaskQueue> taskQueue = std::make_shared<GPGPU_LIB::GPGPUTaskQueue>(chunks.size() + n);
+			state->chunkSource = taskQueue;
+			for (auto& chunk : chunks)
+			{
+				taskQueue->push(chunk);
+			}
 
-			workers[i]->run(kernelName, offsetElement, offsets[i], ranges[i], numLocalThreads);
+			// compute kernels with balanced loads
+			for (int i = 0; i < n; i++)
+			{
+				// mark end of queue for each worker
+				GPGPU_LIB::GPGPUTask task;
+				task.taskType = GPGPU_LIB::GPGPUTask::GPGPU_TASK_NULL;
+				taskQueue->push(task);
+				workers[i]->runTasks(taskQueue.get(), kernelId, fineGrainedPipelineDepth, outOfCore);
+			}
 		}
 
+		return state;
+	}
 
-		// do some work while gpus are working independently
-		oldLoadBalnc.push_back(avg);
+	// normalized throughputs (work / time) of devices measured in last run of a kernel
+	std::vector<double> Computer::throughputShares(int kernelId)
+	{
+		const int n = workers.size();
+		std::vector<double> shares(n, 1.0 / n);
 		double norm = 0.0;
 
 		for (int i = 0; i < n; i++)
 		{
-			nano[i] = ranges[i];
-			norm += ranges[i];
-		}
-
-		for (int i = 0; i < n; i++)
-		{
-			nano[i] /= norm;
+			std::unique_lock<std::mutex> lock(workers[i]->commonSync);
+			shares[i] = workers[i]->works[kernelId] / workers[i]->benchmarks[kernelId];
+			norm += shares[i];
 		}
 
 		for (int i = 0; i < n; i++)
 		{
-			workers[i]->waitAllTasks();
+			shares[i] /= norm;
 		}
-
-		return nano;
+		return shares;
 	}
 
-	// applies load-balancing between calls
-	std::vector<double> Computer::runMultiple(std::vector<std::string> kernelNames, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads)
+
+	// computes normalized work ratios of devices for next run of a kernel (or a kernel group of runMultiple)
+	std::vector<double> Computer::computeLoadBalance(int kernelId, size_t numGlobalThreads)
 	{
-		std::string kernelName;
-		for (auto& str : kernelNames)
-		{
-			kernelName += (str + " ");
-		}
 		const int n = workers.size();
+		const int bucket = sizeBucket(numGlobalThreads);
 		std::vector<double> nano(n);
-		if (loadBalances.find(kernelName) == loadBalances.end())
+		BalanceState& balance = balanceStates[kernelId][bucket];
+		if (balance.ratios.size() != n)
 		{
-			loadBalances[kernelName] = std::vector<double>(n, 1.0);
+			balance.ratios = std::vector<double>(n, 1.0);
 		}
 
-		std::vector<double>& selectedKernelLB = loadBalances[kernelName];
+		std::vector<double>& selectedKernelLB = balance.ratios;
 
 
 		// compute load-balancing
-		auto& oldLoadBalnc = oldLoadBalances[kernelName];
+		auto& oldLoadBalnc = balance.history;
 		const int nlb = oldLoadBalnc.size();
 		double totalLoad = 0;
 		std::vector<double> avg(n, 0);
@@ -455,19 +866,12 @@ namespace GPGPU
 
 		}
 
+		// capability = run_size / run_time (of last run of this kernel in this size bucket)
+		// a size that was not run before starts from capabilities of neighboring buckets
+		std::vector<double> capability = bucketCapabilities(kernelId, bucket);
 		for (int i = 0; i < n; i++)
 		{
-			std::unique_lock<std::mutex> lock(workers[i]->commonSync);
-			if (workers[i]->benchmarks.find(kernelName) == workers[i]->benchmarks.end())
-				workers[i]->benchmarks[kernelName] = 1;
-			nano[i] = workers[i]->benchmarks[kernelName];
-
-		}
-
-		for (int i = 0; i < n; i++)
-		{
-			nano[i] = ranges[i] / nano[i]; // capability = run_size / run_time
-			nano[i] = (avg[i] + (nano[i] * 4)) / (nlb + 4);
+			nano[i] = (avg[i] + (capability[i] * 4)) / (nlb + 4);
 			totalLoad += nano[i];
 		}
 
@@ -486,10 +890,222 @@ namespace GPGPU
 		if (oldLoadBalnc.size() > 1)
 			oldLoadBalnc.resize(1);
 
+		oldLoadBalnc.push_back(avg);
+
+		// cost model overrides the ratios once every device has enough samples
+		std::vector<double> affineLoads = affineLoadBalance(kernelId, numGlobalThreads);
+		if (loadBalancingMode == LOAD_BALANCE_AFFINE && affineLoads.size() == n)
+		{
+			selectedKernelLB = affineLoads;
+		}
+
+		std::vector<double> loads = selectedKernelLB;
+		excludedDevices.assign(n, false);
+
+		// a device that gets zero work from cost model would finish later than others even with a single work-group
+		// it is left out of this run unless it is time to re-probe it (to notice if it became faster or less loaded)
+		if (deviceExclusion && affineLoads.size() == n)
+		{
+			const size_t launchCount = ++launchCounts[kernelId];
+			const bool reprobe = (reprobeInterval > 0) && (launchCount % reprobeInterval == 0);
+			double norm = 0.0;
+			for (int i = 0; i < n; i++)
+			{
+				if (affineLoads[i] <= 0.0 && !reprobe)
+				{
+					excludedDevices[i] = true;
+					loads[i] = 0.0;
+				}
+				norm += loads[i];
+			}
+
+			for (int i = 0; i < n; i++)
+			{
+				loads[i] /= norm;
+			}
+		}
+
+		return loads;
+	}
+
+	// least-squares fit of t = a + b*n on (n, t) samples of a device
+	// returns false if there are not enough samples
+	static bool fitCostModel(const std::vector<std::pair<double, double>>& samples, double& a, double& b)
+	{
+		const int k = samples.size();
+		if (k < 2)
+			return false;
+
+		double meanN = 0, meanT = 0;
+		for (auto& s : samples)
+		{
+			meanN += s.first;
+			meanT += s.second;
+		}
+		meanN /= k;
+		meanT /= k;
+
+		double covNT = 0, varN = 0;
+		double minT = samples[0].second;
+		for (auto& s : samples)
+		{
+			covNT += (s.first - meanN) * (s.second - meanT);
+			varN += (s.first - meanN) * (s.first - meanN);
+			minT = std::min(minT, s.second);
+		}
+
+		// all samples have (nearly) same size: fixed cost can not be separated from per-item cost
+		if (varN <= 1e-4 * meanN * meanN)
+		{
+			a = 0;
+			b = meanT / meanN;
+			return true;
+		}
+
+		b = covNT / varN;
+		a = meanT - b * meanN;
+
+		// noisy samples: keep the model physically meaningful
+		if (b <= 0)
+		{
+			a = 0;
+			b = meanT / meanN;
+		}
+		a = std::max(0.0, std::min(a, minT));
+		return true;
+	}
+
+	// solves for the work split that equalizes predicted finish times of t_i = a_i + b_i * n_i under sum(n_i) = numGlobalThreads
+	// devices with fixed cost higher than the common finish time get zero work
+	// returns empty vector when a device does not have enough samples
+	std::vector<double> Computer::affineLoadBalance(int kernelId, size_t numGlobalThreads)
+	{
+		const int n = workers.size();
+		const std::vector<std::vector<std::pair<double, double>>>& samples = costSamples[kernelId];
+
+		std::vector<double> a(n), b(n);
+		std::vector<int> order(n);
+		for (int i = 0; i < n; i++)
+		{
+			if (!fitCostModel(samples[i], a[i], b[i]))
+				return std::vector<double>();
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&](int d1, int d2) { return a[d1] < a[d2]; });
+
+		// water-filling: add devices in order of fixed cost until the next one would finish later than the others
+		const double total = (double)numGlobalThreads;
+		double sumInvB = 0, sumAOverB = 0, finishTime = 0;
+		for (int k = 0; k < n; k++)
+		{
+			const int d = order[k];
+			sumInvB += 1.0 / b[d];
+			sumAOverB += a[d] / b[d];
+			finishTime = (total + sumAOverB) / sumInvB;
+			if (k + 1 < n && finishTime <= a[order[k + 1]])
+				break;
+		}
+
+		std::vector<double> loads(n, 0.0);
+		for (int i = 0; i < n; i++)
+		{
+			if (finishTime > a[i])
+				loads[i] = ((finishTime - a[i]) / b[i]) / total;
+		}
+		return loads;
+	}
+
+	// records benchmarks of last run into its size bucket and (work, time) samples for the cost model
+	void Computer::recordMeasurements(int kernelId, size_t numGlobalThreads)
+	{
+		const int n = workers.size();
+		BalanceState& balance = balanceStates[kernelId][sizeBucket(numGlobalThreads)];
+		balance.benchmarks.resize(n, 1.0);
+		balance.works.resize(n, 1.0);
+		auto& samples = costSamples[kernelId];
+		for (int i = 0; i < n; i++)
+		{
+			// excluded device did not run
+			if (ranges[i] == 0)
+				continue;
+
+			std::unique_lock<std::mutex> lock(workers[i]->commonSync);
+			balance.benchmarks[i] = workers[i]->benchmarks[kernelId];
+			balance.works[i] = workers[i]->works[kernelId];
+			samples[i].push_back(std::pair<double, double>(balance.works[i], balance.benchmarks[i]));
+			if (samples[i].size() > maxCostSamples)
+				samples[i].erase(samples[i].begin());
+		}
+	}
+
+	int Computer::sizeBucket(size_t numGlobalThreads)
+	{
+		int bucket = 0;
+		while (numGlobalThreads > 1)
+		{
+			numGlobalThreads >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+
+	// capabilities (work / time) of devices in a size bucket
+	// unmeasured bucket: linear interpolation between nearest measured smaller and bigger buckets, or the nearest one if only one side is measured
+	std::vector<double> Computer::bucketCapabilities(int kernelId, int bucket)
+	{
+		const int n = workers.size();
+		std::vector<double> capability(n, 1.0);
+
+		// measured buckets in increasing order
+		std::vector<std::pair<int, const BalanceState*>> measured;
+		for (auto& e : balanceStates[kernelId])
+		{
+			if (e.second.benchmarks.size() == n)
+				measured.push_back(std::pair<int, const BalanceState*>(e.first, &e.second));
+		}
+
+		if (measured.size() == 0)
+			return capability;
+
+		auto measuredCapabilities = [&](const BalanceState* b) {
+			std::vector<double> result(n);
+			for (int i = 0; i < n; i++)
+			{
+				result[i] = b->works[i] / b->benchmarks[i];
+			}
+			return result;
+		};
+
+		auto upper = std::lower_bound(measured.begin(), measured.end(), bucket, [](const std::pair<int, const BalanceState*>& e, int b) { return e.first < b; });
+		if (upper != measured.end() && upper->first == bucket)
+			return measuredCapabilities(upper->second);
+
+		if (upper == measured.end())
+			return measuredCapabilities(measured.back().second);
+
+		if (upper == measured.begin())
+			return measuredCapabilities(upper->second);
+
+		auto lower = std::prev(upper);
+		std::vector<double> low = measuredCapabilities(lower->second);
+		std::vector<double> high = measuredCapabilities(upper->second);
+		const double t = (double)(bucket - lower->first) / (double)(upper->first - lower->first);
+		for (int i = 0; i < n; i++)
+		{
+			capability[i] = low[i] + (high[i] - low[i]) * t;
+		}
+		return capability;
+	}
+
+	// converts work ratios to work-group-aligned ranges and offsets
+	void Computer::distributeRanges(int kernelId, const std::vector<double>& loads, size_t numGlobalThreads, size_t numLocalThreads)
+	{
+		const int n = workers.size();
+
 		// calculate ranges
 		for (int i = 0; i < n; i++)
 		{
-			ranges[i] = (((size_t)(numGlobalThreads * selectedKernelLB[i])) / numLocalThreads) * numLocalThreads;
+			ranges[i] = (((size_t)(numGlobalThreads * loads[i])) / numLocalThreads) * numLocalThreads;
 		}
 
 		size_t totalThreads = 0;
@@ -497,6 +1113,12 @@ namespace GPGPU
 		// refine ranges (invalid values)
 		for (int i = 0; i < n; i++)
 		{
+			if (excludedDevices[i])
+			{
+				ranges[i] = 0;
+				continue;
+			}
+
 			// if no work was given, give it at least single work group 
 			if (ranges[i] == 0)
 			{
@@ -536,7 +1158,7 @@ namespace GPGPU
 					toBeSubtracted -= numLocalThreads;
 				}
 
-				if (toBeAdded > 0)
+				if (toBeAdded > 0 && !excludedDevices[i])
 				{
 					ranges[i] += numLocalThreads;
 					toBeAdded -= numLocalThreads;
@@ -558,7 +1180,7 @@ namespace GPGPU
 			for (int i = 0; i < n; i++)
 			{
 				err += std::string("\n performance of device = ");
-				err += std::to_string(workers[i]->benchmarks[kernelName]);
+				err += std::to_string(workers[i]->benchmarks[kernelId]);
 			}
 			throw std::invalid_argument(err);
 		}
@@ -571,16 +1193,88 @@ namespace GPGPU
 			offsets[i] = curOfs;
 			curOfs += ranges[i];
 		}
+	}
+
+	// applies load-balancing between calls
+	std::vector<double> Computer::run(std::string kernelName, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads)
+	{
+		finishPendingCompute();
+		return ComputeHandle(startRun(kernelIdOf(kernelName), std::vector<int>(), offsetElement, numGlobalThreads, numLocalThreads)).wait();
+	}
+
+	std::vector<double> Computer::run(int kernelId, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads)
+	{
+		finishPendingCompute();
+		if (kernelId < 0 || kernelId >= kernelNamesOfIds.size())
+		{
+			throw std::invalid_argument(std::string("error: invalid kernel handle: ") + std::to_string(kernelId));
+		}
+		return ComputeHandle(startRun(kernelId, std::vector<int>(), offsetElement, numGlobalThreads, numLocalThreads)).wait();
+	}
 
-		// compute kernels with balanced loads			
+	// applies load-balancing between calls
+	std::vector<double> Computer::runMultiple(std::vector<std::string> kernelNames, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads)
+	{
+		finishPendingCompute();
+		std::vector<int> groupKernelIds;
+		const int groupId = kernelGroupIds(kernelNames, groupKernelIds);
+		return ComputeHandle(startRun(groupId, groupKernelIds, offsetElement, numGlobalThreads, numLocalThreads)).wait();
+	}
+
+	int Computer::kernelGroupIds(const std::vector<std::string>& kernelNames, std::vector<int>& groupKernelIds)
+	{
+		groupKernelIds.clear();
+		for (auto& name : kernelNames)
+		{
+			groupKernelIds.push_back(kernelIdOf(name));
+		}
+		return createKernelId(joinedKernelNames(kernelNames));
+	}
+
+	// key of load-balancing data of a kernel group
+	std::string Computer::joinedKernelNames(const std::vector<std::string>& kernelNames)
+	{
+		std::string kernelName;
+		for (auto& str : kernelNames)
+		{
+			kernelName += (str + " ");
+		}
+		return kernelName;
+	}
+
+	// distributes work and gives it to workers without waiting them
+	// groupKernelIds is empty for single kernel, otherwise kernelId is the key of kernel group
+	std::shared_ptr<ComputeState> Computer::startRun(int kernelId, std::vector<int> groupKernelIds, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads)
+	{
+		if (groupKernelIds.empty())
+			throwIfOutOfCore(kernelId);
+		for (int groupKernelId : groupKernelIds)
+			throwIfOutOfCore(groupKernelId);
+
+		const int n = workers.size();
+		std::shared_ptr<ComputeState> state = std::make_shared<ComputeState>();
+		state->kernelIds = groupKernelIds;
+		const int* kernelIdsOfGroup = state->kernelIds.size() > 0 ? state->kernelIds.data() : nullptr;
+		std::vector<double>& nano = state->ratios;
+		nano.resize(n);
+		distributeRanges(kernelId, computeLoadBalance(kernelId, numGlobalThreads), numGlobalThreads, numLocalThreads);
+		if (groupKernelIds.empty())
+			refreshResidentRanges(kernelId, offsetElement, offsets, ranges);
+		for (int groupKernelId : groupKernelIds)
+			refreshResidentRanges(groupKernelId, offsetElement, offsets, ranges);
+
+		// compute kernels with balanced loads
 		for (int i = 0; i < n; i++)
 		{
-			workers[i]->run(kernelName, offsetElement, offsets[i], ranges[i], numLocalThreads, true, kernelNames);
+			if (ranges[i] > 0)
+			{
+				workers[i]->run(kernelId, offsetElement, offsets[i], ranges[i], numLocalThreads, kernelIdsOfGroup, state->kernelIds.size(), overlapChunks);
+				state->workers.push_back(workers[i]);
+			}
 		}
 
 
 		// do some work while gpus are working independently
-		oldLoadBalnc.push_back(avg);
 		double norm = 0.0;
 
 		for (int i = 0; i < n; i++)
@@ -594,12 +1288,76 @@ namespace GPGPU
 			nano[i] /= norm;
 		}
 
-		for (int i = 0; i < n; i++)
+		state->finalize = [this, kernelId, numGlobalThreads](ComputeState&) { recordMeasurements(kernelId, numGlobalThreads); mergeDeviceResults(); };
+		return state;
+	}
+
+	void Computer::throwIfOutOfCore(int kernelId)
+	{
+		if (outOfCoreBindings[kernelId] == 0)
+			return;
+
+		// names are only looked up for the error message
+		for (auto& bound : boundParameterIds[kernelId])
 		{
-			workers[i]->waitAllTasks();
+			const std::string& name = parameterNamesOfIds[bound.second];
+			auto it = hostParameters.find(name);
+			if (it != hostParameters.end() && it->second.isOutOfCore())
+			{
+				throw std::invalid_argument(std::string("error: out-of-core parameter ") + name + " can only be used by computeOutOfCore: " + kernelNamesOfIds[kernelId]);
+			}
+		}
+	}
+
+	std::vector<double> Computer::computeOutOfCore(
+		GPGPU::HostParameter prm,
+		std::string kernelName,
+		size_t offsetElement,
+		size_t numGlobalThreads,
+		size_t numLocalThreads,
+		size_t tileThreads)
+	{
+		finishPendingCompute();
+		const int kernelId = kernelIdOf(kernelName);
+		if (numLocalThreads == 0 || tileThreads == 0 || tileThreads % numLocalThreads != 0 || numGlobalThreads % numLocalThreads != 0)
+		{
+			throw std::invalid_argument(std::string("error: number of global threads and tile size must be non-zero multiples of number of local threads: ") + kernelName);
+		}
+
+		for (int i = 0; i < prm.prmList.size(); i++)
+		{
+			const std::string& name = prm.prmList[i];
+			auto it = hostParameters.find(name);
+			if (it == hostParameters.end())
+			{
+				throw std::invalid_argument(std::string("error: parameter not found: ") + name);
+			}
+
+			// kernel indexes every load-balanced parameter relative to the tile
+			const HostParameter& parameter = it->second;
+			const bool perThreadRegion = (parameter.readOp && !parameter.readAllOp) || (parameter.writeOp && !parameter.writeAllOp);
+			if (parameter.isResident() || (perThreadRegion && !parameter.isOutOfCore()))
+			{
+				throw std::invalid_argument(std::string("error: load-balanced and resident parameters of an out-of-core run must be out-of-core: ") + name);
+			}
+
+			if (parameter.isOutOfCore() && (offsetElement + numGlobalThreads) * parameter.elementsPerThr > parameter.n)
+			{
+				throw std::invalid_argument(std::string("error: range of kernel ") + kernelName + " exceeds elements of parameter: " + name);
+			}
+			setKernelParameter(kernelName, name, i);
 		}
 
-		return nano;
+		return ComputeHandle(startFineGrainedLoadBalancing(kernelId, offsetElement, numGlobalThreads, numLocalThreads, tileThreads, true)).wait();
+	}
+
+	void Computer::finishPendingCompute()
+	{
+		if (pendingCompute)
+		{
+			ComputeHandle(pendingCompute).wait();
+			pendingCompute = nullptr;
+		}
 	}
 
 	std::vector<double> Computer::compute(
@@ -611,18 +1369,31 @@ namespace GPGPU
 		bool fineGrainedLoadBalancing,
 		size_t fineGrainSize)
 	{
-		std::vector<double> performancesOfDevices;
+		return computeAsync(prm, kernelName, offsetElement, numGlobalThreads, numLocalThreads, fineGrainedLoadBalancing, fineGrainSize).wait();
+	}
+
+	ComputeHandle Computer::computeAsync(
+		GPGPU::HostParameter prm,
+		std::string kernelName,
+		size_t offsetElement,
+		size_t numGlobalThreads,
+		size_t numLocalThreads,
+		bool fineGrainedLoadBalancing,
+		size_t fineGrainSize)
+	{
+		finishPendingCompute();
 		const int k = prm.prmList.size();
 		for (int i = 0; i < k; i++)
 		{
 			setKernelParameter(kernelName, prm.prmList[i], i);
 		}
 
+		const int kernelId = kernelIdOf(kernelName);
 		if (fineGrainedLoadBalancing)
-			performancesOfDevices = runFineGrainedLoadBalancing(kernelName, offsetElement, numGlobalThreads, numLocalThreads, fineGrainSize == 0 ? numLocalThreads : fineGrainSize);
+			pendingCompute = startFineGrainedLoadBalancing(kernelId, offsetElement, numGlobalThreads, numLocalThreads, fineGrainSize == 0 ? numLocalThreads : fineGrainSize);
 		else
-			performancesOfDevices = run(kernelName, offsetElement, numGlobalThreads, numLocalThreads);
-		return performancesOfDevices;
+			pendingCompute = startRun(kernelId, std::vector<int>(), offsetElement, numGlobalThreads, numLocalThreads);
+		return ComputeHandle(pendingCompute);
 	}
 
 	std::vector<double> Computer::computeMultiple(
@@ -634,8 +1405,20 @@ namespace GPGPU
 		bool fineGrainedLoadBalancing,
 		size_t fineGrainSize)
 	{
+		return computeMultipleAsync(prms, kernelNames, offsetElement, numGlobalThreads, numLocalThreads, fineGrainedLoadBalancing, fineGrainSize).wait();
+	}
+
+	ComputeHandle Computer::computeMultipleAsync(
+		std::vector<GPGPU::HostParameter> prms,
+		std::vector<std::string> kernelNames,
+		size_t offsetElement,
+		size_t numGlobalThreads,
+		size_t numLocalThreads,
+		bool fineGrainedLoadBalancing,
+		size_t fineGrainSize)
+	{
+		finishPendingCompute();
 		std::map<std::string, bool> isSet;
-		std::vector<double> performancesOfDevices;
 		const int n = prms.size();
 
 		for (int i = 0; i < n; i++)
@@ -654,27 +1437,32 @@ namespace GPGPU
 
 		if (fineGrainedLoadBalancing)
 		{
+			// all devices must finish a kernel before any device starts next kernel so only the last kernel runs asynchronously
 			const int nw = workers.size();
-			performancesOfDevices.resize(nw);
-			for (int j = 0; j < nw; j++)
-			{
-				performancesOfDevices[j] = 0;
-			}
-			for (int i = 0; i < n; i++)
+			std::vector<double> performancesOfDevices(nw, 0.0);
+			for (int i = 0; i < n - 1; i++)
 			{
-				auto performancesOfDevicesTmp = runFineGrainedLoadBalancing(kernelNames[i], offsetElement, numGlobalThreads, numLocalThreads, fineGrainSize == 0 ? numLocalThreads : fineGrainSize);
+				auto performancesOfDevicesTmp = ComputeHandle(startFineGrainedLoadBalancing(kernelIdOf(kernelNames[i]), offsetElement, numGlobalThreads, numLocalThreads, fineGrainSize == 0 ? numLocalThreads : fineGrainSize)).wait();
 				for (int j = 0; j < nw; j++)
 					performancesOfDevices[j] += performancesOfDevicesTmp[j];
 			}
-			for (int j = 0; j < nw; j++)
-				performancesOfDevices[j] /= nw;
+
+			pendingCompute = startFineGrainedLoadBalancing(kernelIdOf(kernelNames[n - 1]), offsetElement, numGlobalThreads, numLocalThreads, fineGrainSize == 0 ? numLocalThreads : fineGrainSize);
+			auto lastKernelFinalize = pendingCompute->finalize;
+			pendingCompute->finalize = [lastKernelFinalize, performancesOfDevices, n, nw](ComputeState& st) {
+				lastKernelFinalize(st);
+				for (int j = 0; j < nw; j++)
+					st.ratios[j] = (st.ratios[j] + performancesOfDevices[j]) / n;
+			};
 		}
 		else
 		{
-			performancesOfDevices = runMultiple(kernelNames, offsetElement, numGlobalThreads, numLocalThreads);
+			std::vector<int> groupKernelIds;
+			const int groupId = kernelGroupIds(kernelNames, groupKernelIds);
+			pendingCompute = startRun(groupId, groupKernelIds, offsetElement, numGlobalThreads, numLocalThreads);
 		}
 
-		return performancesOfDevices;
+		return ComputeHandle(pendingCompute);
 	}
 
 	std::vector<std::string> Computer::deviceNames(bool detailed)
@@ -689,4 +1477,252 @@ namespace GPGPU
 		}
 		return names;
 	}
+
+	std::vector<DeviceTimings> Computer::getDeviceTimings(std::string kernelName)
+	{
+		finishPendingCompute();
+		std::vector<DeviceTimings> timings;
+		auto id = kernelIds.find(kernelName);
+		for (int i = 0; i < workers.size(); i++)
+		{
+			std::unique_lock<std::mutex> lock(workers[i]->commonSync);
+			DeviceTimings t = { 0.0, 0.0, 0.0, 0.0 };
+			if (id != kernelIds.end())
+			{
+				t.upload = workers[i]->uploadBenchmarks[id->second];
+				t.kernel = workers[i]->kernelBenchmarks[id->second];
+				t.download = workers[i]->downloadBenchmarks[id->second];
+				t.total = workers[i]->benchmarks[id->second];
+			}
+			timings.push_back(t);
+		}
+		return timings;
+	}
+
+	uint64_t Computer::sourceHashOfKey(const std::string& key)
+	{
+		uint64_t hash = 0;
+		std::istringstream names(key.substr(0, key.rfind('@')));
+		std::string name;
+		while (names >> name)
+		{
+			auto it = kernelSourceHashes.find(name);
+			if (it == kernelSourceHashes.end())
+				return 0;
+			hash ^= it->second + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+		}
+		return hash;
+	}
+
+	uint64_t Computer::deviceSignatureHash()
+	{
+		std::string signature;
+		for (auto& name : deviceNames(true))
+			signature += name + "\n";
+		return hashString(signature);
+	}
+
+	void Computer::saveLoadBalanceProfile(std::string fileName)
+	{
+		finishPendingCompute();
+		const int n = workers.size();
+		std::ofstream file(fileName, std::ios::trunc);
+		if (!file)
+		{
+			throw std::invalid_argument(std::string("error: can not open load-balance profile for writing: ") + fileName);
+		}
+
+		// every kernel (and kernel group of runMultiple) with its last measurement, followed by its size-bucketed state ("kernelName@bucket")
+		size_t nKeys = 0;
+		for (auto& buckets : balanceStates)
+			nKeys += 1 + buckets.size();
+
+		file << std::setprecision(17);
+		file << "libGPGPU-load-balance-profile " << loadBalanceProfileVersion << "\n";
+		file << deviceSignatureHash() << " " << n << "\n";
+		file << nKeys << "\n";
+		for (int id = 0; id < kernelNamesOfIds.size(); id++)
+		{
+			const std::string& name = kernelNamesOfIds[id];
+			file << "kernel " << std::quoted(name) << " " << sourceHashOfKey(name) << "\n";
+			writeValues(file, "ratios", std::vector<double>());
+			file << "history 0\n";
+
+			std::vector<double> benchmarks(n, 1.0);
+			std::vector<double> works(n, 1.0);
+			for (int i = 0; i < n; i++)
+			{
+				std::unique_lock<std::mutex> lock(workers[i]->commonSync);
+				benchmarks[i] = workers[i]->benchmarks[id];
+				works[i] = workers[i]->works[id];
+			}
+			writeValues(file, "benchmarks", benchmarks);
+			writeValues(file, "works", works);
+
+			// cost model samples as flattened (work, time) pairs per device
+			for (int i = 0; i < n; i++)
+			{
+				std::vector<double> flat;
+				for (auto& smp : costSamples[id][i])
+				{
+					flat.push_back(smp.first);
+					flat.push_back(smp.second);
+				}
+				writeValues(file, "samples", flat);
+			}
+
+			for (auto& bucket : balanceStates[id])
+			{
+				const BalanceState& balance = bucket.second;
+				const std::string key = name + "@" + std::to_string(bucket.first);
+				file << "kernel " << std::quoted(key) << " " << sourceHashOfKey(key) << "\n";
+				writeValues(file, "ratios", balance.ratios);
+				file << "history " << balance.history.size() << "\n";
+				for (auto& values : balance.history)
+					writeValues(file, "values", values);
+				writeValues(file, "benchmarks", balance.benchmarks.size() == n ? balance.benchmarks : std::vector<double>(n, 1.0));
+				writeValues(file, "works", balance.works.size() == n ? balance.works : std::vector<double>(n, 1.0));
+				for (int i = 0; i < n; i++)
+					writeValues(file, "samples", std::vector<double>());
+			}
+		}
+
+		if (!file)
+		{
+			throw std::invalid_argument(std::string("error: can not write load-balance profile: ") + fileName);
+		}
+	}
+
+	bool Computer::loadLoadBalanceProfile(std::string fileName)
+	{
+		finishPendingCompute();
+		std::ifstream file(fileName);
+		if (!file)
+			return false;
+
+		const int n = workers.size();
+		std::string tag;
+		int version = 0;
+		uint64_t deviceHash = 0;
+		int nDevices = 0;
+		size_t nKeys = 0;
+		file >> tag >> version >> deviceHash >> nDevices >> nKeys;
+		if (!file || tag != "libGPGPU-load-balance-profile" || version != loadBalanceProfileVersion)
+		{
+			throw std::invalid_argument(std::string("error: not a load-balance profile or unsupported version: ") + fileName);
+		}
+
+		// saved for other devices
+		if (deviceHash != deviceSignatureHash() || nDevices != n)
+			return false;
+
+		for (size_t k = 0; k < nKeys; k++)
+		{
+			std::string key;
+			uint64_t sourceHash = 0;
+			size_t nHistory = 0;
+			file >> tag >> std::quoted(key) >> sourceHash;
+			if (!file || tag != "kernel")
+			{
+				throw std::invalid_argument(std::string("error: corrupt load-balance profile (expected kernel): ") + fileName);
+			}
+
+			std::vector<double> ratios = readValues(file, "ratios", fileName);
+			file >> tag >> nHistory;
+			if (!file || tag != "history")
+			{
+				throw std::invalid_argument(std::string("error: corrupt load-balance profile (expected history): ") + fileName);
+			}
+			std::vector<std::vector<double>> history;
+			for (size_t i = 0; i < nHistory; i++)
+				history.push_back(readValues(file, "values", fileName));
+			std::vector<double> benchmarks = readValues(file, "benchmarks", fileName);
+			std::vector<double> works = readValues(file, "works", fileName);
+			if (!file || benchmarks.size() != n || works.size() != n)
+			{
+				throw std::invalid_argument(std::string("error: corrupt load-balance profile (benchmarks): ") + fileName);
+			}
+			std::vector<std::vector<std::pair<double, double>>> samples(n);
+			for (int i = 0; i < n; i++)
+			{
+				std::vector<double> flat = readValues(file, "samples", fileName);
+				for (size_t j = 0; j + 1 < flat.size(); j += 2)
+					samples[i].push_back(std::pair<double, double>(flat[j], flat[j + 1]));
+			}
+
+			// kernel is not compiled or its source code has changed
+			if (sourceHash == 0 || sourceHash != sourceHashOfKey(key))
+				continue;
+
+			// size-bucketed state
+			const size_t bucketPos = key.rfind('@');
+			if (bucketPos != std::string::npos)
+			{
+				BalanceState& balance = balanceStates[createKernelId(key.substr(0, bucketPos))][std::stoi(key.substr(bucketPos + 1))];
+				if (ratios.size() == n)
+					balance.ratios = ratios;
+				balance.history = history;
+				balance.benchmarks = benchmarks;
+				balance.works = works;
+				continue;
+			}
+
+			const int id = createKernelId(key);
+			costSamples[id] = samples;
+			for (int i = 0; i < n; i++)
+			{
+				std::unique_lock<std::mutex> lock(workers[i]->commonSync);
+				workers[i]->benchmarks[id] = benchmarks[i];
+				workers[i]->works[id] = works[i];
+			}
+		}
+		return true;
+	}
+
+	ComputeHandle::ComputeHandle()
+	{
+
+	}
+
+	ComputeHandle::ComputeHandle(std::shared_ptr<ComputeState> computeState) :state(computeState)
+	{
+
+	}
+
+	bool ComputeHandle::ready()
+	{
+		if (!state)
+			return true;
+
+		std::lock_guard<std::mutex> lock(state->syncPoint);
+		if (state->finished)
+			return true;
+
+		// a worker pushes to its retire queue after completing the task
+		for (auto& w : state->workers)
+		{
+			if (!w->retireQueue.inProgress())
+				return false;
+		}
+		return true;
+	}
+
+	std::vector<double> ComputeHandle::wait()
+	{
+		if (!state)
+			return std::vector<double>();
+
+		std::lock_guard<std::mutex> lock(state->syncPoint);
+		if (!state->finished)
+		{
+			for (auto& w : state->workers)
+			{
+				w->waitAllTasks();
+			}
+			state->finished = true;
+			if (state->finalize)
+				state->finalize(*state);
+		}
+		return state->ratios;
+	}
 }
\ No newline at end of file
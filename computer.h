@@ -7,11 +7,72 @@
 #include "gpgpu_init.hpp"
 #include "worker.h"
 #include "platform.h"
+#include "compute-stream.h"
+#include "launch-plan.h"
+#include "host-memory.h"
 #include <map>
 #include <memory>
 #include <vector>
+#include <set>
+#include <cstdint>
+#include <functional>
+#include <limits>
 namespace GPGPU
 {
+	// time breakdown of last run of a kernel on a device, in nanoseconds
+	// upload, kernel and download are device-side durations from OpenCL event profiling (sums over all commands of the run)
+	// total is measured on host and includes synchronization and command-issue latency
+	struct DeviceTimings
+	{
+		double upload;
+		double kernel;
+		double download;
+		double total;
+	};
+
+	// completion state of a computation that is given to workers
+	struct ComputeState
+	{
+		std::mutex syncPoint;
+		bool finished;
+
+		// workers that were given work
+		std::vector<std::shared_ptr<GPGPU_LIB::Worker>> workers;
+
+		// workload ratios of devices
+		std::vector<double> ratios;
+
+		// bookkeeping after all workers complete (benchmarks, load-balancing data)
+		std::function<void(ComputeState&)> finalize;
+
+		// data that workers' tasks point to (kernel ids of a multiple-kernel run, chunk source of fine-grained run), kept until workers complete
+		std::vector<int> kernelIds;
+		std::shared_ptr<void> chunkSource;
+
+		ComputeState() :finished(false) {}
+	};
+
+	/*
+		handle of an asynchronous computation (Computer::computeAsync, Computer::computeMultipleAsync)
+		host parameters of the computation must not be accessed until wait() returns or ready() returns true
+		any other method of Computer that uses devices waits for the computation first
+	*/
+	struct ComputeHandle
+	{
+		friend struct Computer;
+	private:
+		std::shared_ptr<ComputeState> state;
+		ComputeHandle(std::shared_ptr<ComputeState> computeState);
+	public:
+		ComputeHandle();
+
+		// returns true if all devices completed their work (does not block)
+		bool ready();
+
+		// blocks until all devices complete their work, returns workload ratios of devices (on the same order their names appear on deviceNames())
+		std::vector<double> wait();
+	};
+
 	// an object for managing devices, kernels, worker cpu threads, load-balancing and creating/using parameters
 	struct Computer
 	{
@@ -22,19 +83,211 @@ namespace GPGPU
 		const static int DEVICE_ACCS = 4;
 		const static int DEVICE_SELECTION_ALL = -1;
 
+		// load-balancing modes of run() and runMultiple()
+		// ratio: work ratio of a device is proportional to its measured throughput (run size / run time)
+		// affine: fits t = a + b * n (fixed overhead + per-item cost) for each device from recent runs and equalizes predicted finish times
+		const static int LOAD_BALANCE_RATIO = 0;
+		const static int LOAD_BALANCE_AFFINE = 1;
+
+		// chunk schedulers of fine-grained load-balancing
+		// shared queue: all devices take chunks from one queue
+		// work stealing: each device takes chunks from its own contiguous block, then steals from far end of other devices' blocks
+		const static int FINE_GRAIN_SHARED_QUEUE = 0;
+		const static int FINE_GRAIN_WORK_STEALING = 1;
+		// guided: chunks start large and shrink towards loadSize as remaining work drops, scaled by each device's measured throughput
+		const static int FINE_GRAIN_GUIDED = 2;
+
+		// page sizes of host parameters (setHostMemoryPolicy)
+		const static int HOST_HUGE_PAGES_NONE = GPGPU_LIB::HostMemoryPolicy::HUGE_PAGES_NONE;
+		const static int HOST_HUGE_PAGES_TRANSPARENT = GPGPU_LIB::HostMemoryPolicy::HUGE_PAGES_TRANSPARENT;
+		const static int HOST_HUGE_PAGES_EXPLICIT = GPGPU_LIB::HostMemoryPolicy::HUGE_PAGES_EXPLICIT;
+
+		// NUMA placement of host parameters (setHostMemoryPolicy)
+		const static int HOST_NUMA_DEFAULT = GPGPU_LIB::HostMemoryPolicy::NUMA_DEFAULT;
+		const static int HOST_NUMA_INTERLEAVE = GPGPU_LIB::HostMemoryPolicy::NUMA_INTERLEAVE;
+		const static int HOST_NUMA_BIND = GPGPU_LIB::HostMemoryPolicy::NUMA_BIND;
+		const static int HOST_NUMA_SPLIT_BY_DEVICES = GPGPU_LIB::HostMemoryPolicy::NUMA_SPLIT_BY_DEVICES;
+
+		// built-in combiners of reduction parameters
+		const static int REDUCE_SUM = 0;
+		const static int REDUCE_MIN = 1;
+		const static int REDUCE_MAX = 2;
+
 	private:
-		std::map<std::string, std::vector<double>> loadBalances;
+		// load-balancing state of a kernel (or kernel group) in a size bucket
+		struct BalanceState
+		{
+			std::vector<double> ratios;
+			std::vector<std::vector<double>> history;
+
+			// run time and work of devices in last run in this bucket (empty until bucket is measured)
+			std::vector<double> benchmarks;
+			std::vector<double> works;
+		};
+
+		// load-balancing state is indexed by kernel id (dense) and keyed by logarithmic size bucket of number of global threads
+		// because a small run is overhead-bound and a big run is throughput-bound
+		std::vector<std::map<int, BalanceState>> balanceStates;
 		std::vector<size_t> offsets;
 		std::vector<size_t> ranges;
-		std::map<std::string, std::vector<std::vector<double>>> oldLoadBalances;
+
+		// recent (work, nanoseconds) samples of each device per kernel id, for affine cost model
+		const static size_t maxCostSamples = 16;
+		std::vector<std::vector<std::vector<std::pair<double, double>>>> costSamples;
+		int loadBalancingMode;
+		int fineGrainedScheduler;
+
+		// devices left out of current run() because the cost model predicts that they would increase its latency
+		std::vector<bool> excludedDevices;
+		bool deviceExclusion;
+		int reprobeInterval;
+		std::vector<size_t> launchCounts;
+
+		// sub-chunks per device in run() for overlapping copies with kernels on same device
+		int overlapChunks;
+
+		// chunks of fine-grained load-balancing that a device keeps enqueued
+		int fineGrainedPipelineDepth;
 
 		GPGPU_LIB::PlatformManager platform;
 		std::vector<std::shared_ptr<GPGPU_LIB::Worker>> workers;
 		std::map<std::string, GPGPU::HostParameter> hostParameters;
 		std::mutex compileLock; // serialize device code compilations
 
+		// dense ids of kernels, kernel clones and kernel groups (space-separated names) that workers and load-balancing state are indexed with
+		std::map<std::string, int> kernelIds;
+		std::vector<std::string> kernelNamesOfIds;
+
+		// dense ids of host parameters (same name gets same id when re-created)
+		std::map<std::string, int> parameterIds;
+		std::vector<std::string> parameterNamesOfIds;
+
+		// returns id of a kernel name (or kernel group key), creates it if it does not exist
+		int createKernelId(const std::string& kernelName);
+
+		// returns id of a compiled kernel (or a clone), throws if it does not exist
+		int kernelIdOf(const std::string& kernelName);
+
+		// gives an id to hostParameters[parameterName] and allocates its buffers on all devices
+		void registerHostParameter(const std::string& parameterName);
+
+		// id of a resident parameter, throws if it does not exist or is not resident
+		int residentParameterId(GPGPU::HostParameter& prm);
+
+		// byte ranges of a resident parameter with the device that wrote them last: begin --> (end, worker index)
+		// devices keep their recorded writes until syncToDevices() makes all copies equal
+		std::map<size_t, std::pair<size_t, int>> residentOwners(int parameterId);
+
+		// before a run: copies parts of work-item ranges of devices ([offsetElement + deviceOffsets[i], + deviceRanges[i])) of kernel's resident parameters
+		// whose last writer is another device from that device (through host), so each device computes from newest data when work split changes between runs
+		void refreshResidentRanges(int kernelId, size_t offsetElement, const std::vector<size_t>& deviceOffsets, const std::vector<size_t>& deviceRanges);
+
+		// ids of reduction parameters
+		std::set<int> reductionParameterIds;
+
+		// combines partial results of reduction parameters that devices downloaded in last run into host arrays
+		void mergeReductions();
+
+		// ids of append buffers and number of elements each device appended in last run that used them
+		std::set<int> appendParameterIds;
+		std::map<int, std::vector<size_t>> appendCountsOfIds;
+
+		// per append buffer id, number of appends each device tried in last run (its counter value, bigger than its count if elements were dropped)
+		std::map<int, std::vector<size_t>> appendRequestsOfIds;
+
+		// copies used prefixes of append buffers that devices downloaded in last run into host arrays (in device order)
+		void mergeAppends();
+
+		// bookkeeping of per-device results after a run (reductions, append buffers)
+		void mergeDeviceResults();
+
+		// page size and NUMA placement of host parameters created after setHostMemoryPolicy
+		GPGPU_LIB::HostMemoryPolicy hostMemoryPolicy;
+
+		// policy for a new host parameter (nullptr = pooled default memory), fills NUMA segments of devices from their last work ratios
+		const GPGPU_LIB::HostMemoryPolicy* memoryPolicyForNewParameter();
+
+		// index of worker whose context pins memory of new host parameters (-1 = pageable memory from pool)
+		int pinnedWorker;
+
+		// context for a new host parameter's page-locked memory (nullptr = pageable)
+		const GPGPU_LIB::Context* pinnedContextForNewParameter();
+
 		// kernel to parameters to position mapping
 		std::map<std::string, std::map<std::string, int>> kernelParameters;
+
+		// per kernel id, incremented whenever setKernelParameter sends a new binding to workers (launch plans re-bind when it changes)
+		std::vector<size_t> bindingVersions;
+
+		// per kernel id, parameter ids bound to argument positions (as workers have them) and number of resident and out-of-core ones among them
+		std::vector<std::map<int, int>> boundParameterIds;
+		std::vector<int> residentBindings;
+		std::vector<int> outOfCoreBindings;
+
+		// records a binding that setKernelParameter sends to workers (replaces parameter at same position)
+		void recordBinding(int kernelId, int parameterPosition, int parameterId);
+
+		// kernel name to hash of its source code (for validating saved load-balance profiles)
+		std::map<std::string, uint64_t> kernelSourceHashes;
+
+		// hash of all kernel sources used by a load-balancing key (single kernel name or space-separated kernel names of runMultiple)
+		// returns 0 if any of kernels is not compiled
+		uint64_t sourceHashOfKey(const std::string& key);
+
+		// hash of device names in worker order
+		uint64_t deviceSignatureHash();
+
+		// computes normalized work ratios of devices for next run of a kernel (or a kernel group of runMultiple)
+		std::vector<double> computeLoadBalance(int kernelId, size_t numGlobalThreads);
+
+		// work ratios that equalize predicted finish times of affine cost models of devices (empty if not enough samples)
+		std::vector<double> affineLoadBalance(int kernelId, size_t numGlobalThreads);
+
+		// records benchmarks of last run into its size bucket and (work, time) samples for the cost model
+		void recordMeasurements(int kernelId, size_t numGlobalThreads);
+
+		// floor(log2(numGlobalThreads))
+		int sizeBucket(size_t numGlobalThreads);
+
+		// capabilities (work / time) of devices in a size bucket, interpolated from neighboring buckets if not measured yet
+		std::vector<double> bucketCapabilities(int kernelId, int bucket);
+
+		// normalized throughputs (work / time) of devices measured in last run of a kernel (equal shares if not measured yet)
+		std::vector<double> throughputShares(int kernelId);
+
+		// computation that was started by computeAsync and not waited yet
+		std::shared_ptr<ComputeState> pendingCompute;
+
+		// waits for pendingCompute (if any) so that workers' retire queues are in sync with the caller again
+		void finishPendingCompute();
+
+		// gives work to workers without waiting them. groupKernelIds is empty for single kernel, otherwise kernelId is the key of kernel group
+		std::shared_ptr<ComputeState> startRun(int kernelId, std::vector<int> groupKernelIds, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads);
+		// outOfCore = true: chunks are tiles of out-of-core parameters (guided scheduler falls back to shared queue because its chunks are bigger than a tile)
+		std::shared_ptr<ComputeState> startFineGrainedLoadBalancing(int kernelId, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads, size_t loadSize, bool outOfCore = false);
+
+		// throws if an out-of-core parameter is bound to kernel (those have no whole-array device buffer, only computeOutOfCore can run them)
+		void throwIfOutOfCore(int kernelId);
+
+		// key of load-balancing data of a kernel group
+		std::string joinedKernelNames(const std::vector<std::string>& kernelNames);
+
+		// id of load-balancing key of a kernel group and ids of its kernels
+		int kernelGroupIds(const std::vector<std::string>& kernelNames, std::vector<int>& groupKernelIds);
+
+		// number of streams created so far (for unique names of their kernel clones and buffer sets)
+		int numStreams;
+
+		// enqueues a batch of a stream's buffer set to workers, returns when commands are enqueued (not completed)
+		void submitStreamBatch(StreamState& stream, int bufferSet);
+		friend struct ComputeStream;
+
+		// re-binds parameters of a plan if another call changed bindings of its kernel, then gives work to workers without waiting them
+		ComputeHandle launchPlan(LaunchPlan& plan);
+		friend struct LaunchPlan;
+
+		// converts work ratios to work-group-aligned ranges and offsets
+		void distributeRanges(int kernelId, const std::vector<double>& loads, size_t numGlobalThreads, size_t numLocalThreads);
 		/*
 			deviceSelection = Computer::DEVICE_ALL ==> uses all gpu & cpu devices
 
@@ -54,13 +307,17 @@ namespace GPGPU
 		*/
 		Computer(int deviceSelection, int selectionIndex = DEVICE_SELECTION_ALL, int clonesPerDevice = 1, bool giveDirectRamAccessToCPU=true, int maxDevices=100);
 
+		// waits for asynchronous computation (if any) before releasing devices
+		~Computer();
+
 		// returns number of queried devices (sum of devices from all platforms)
 		int getNumDevices();
 
 		/* compiles kernel code for given kernel name(that needs to be same as the function name in the kernel code) for all devices
 		* not thread-safe between multiple Computer objects
+		* returns integer handle of kernel (for run(int kernelId, ...) to skip name lookups). recompiling same kernel name returns same handle
 		*/
-		void compile(std::string kernelCode, std::string kernelName);
+		int compile(std::string kernelCode, std::string kernelName);
 
 		/* 
 		parameterName: parameter's name that is used when binding to kernel by setKernelParameter() or by method chaining ( computer.compute(  a.next(b).next(c), "kernelName",..   )  )
@@ -70,16 +327,14 @@ namespace GPGPU
 		isInput = true ==> this parameter's host data is copied to devices before kernel is run (each device gets its own region unless isInputWithAllElements=true)
 		isOutput=true ==> this parameter's devices' data are copied to host after kernel is run (each device copies its own regio)
 		isInputWithAllElements=true ==> whole buffer is read instead of thread's own region when isInput=true. This is useful when all devices need a copy of whole array.
-		!!! host parameter can only be input-only or output-only (currently) (because this lets all devices run independently without extra synchronization cost) !!!
+		isInput=true and isOutput=true ==> in-place parameter: each device uploads its own region, kernel updates it and device downloads same region (not allowed with isInputWithAllElements or isOutputWithAllElements)
 		*/
 		template<typename T>
-		HostParameter createHostParameter(std::string parameterName, size_t numElements, size_t numElementsPerThread, bool isInput, bool isOutput, bool isInputWithAllElements,bool isOutputWithAllElements, bool isScalar)
+		HostParameter createHostParameter(std::string parameterName, size_t numElements, size_t numElementsPerThread, bool isInput, bool isOutput, bool isInputWithAllElements,bool isOutputWithAllElements, bool isScalar, bool isResident = false, size_t haloElements = 0)
 		{
-			hostParameters[parameterName] = HostParameter(parameterName, numElements, sizeof(T), numElementsPerThread, isInput, isOutput, isInputWithAllElements,isOutputWithAllElements,isScalar);
-			for (int i = 0; i < workers.size(); i++)
-			{
-				workers[i]->mirror(&hostParameters[parameterName]);
-			}
+			finishPendingCompute();
+			hostParameters[parameterName] = HostParameter(parameterName, numElements, sizeof(T), numElementsPerThread, isInput, isOutput, isInputWithAllElements,isOutputWithAllElements,isScalar,isResident,haloElements,memoryPolicyForNewParameter(),"",false,pinnedContextForNewParameter());
+			registerHostParameter(parameterName);
 			return hostParameters[parameterName];
 		}
 
@@ -106,6 +361,14 @@ namespace GPGPU
 			return createHostParameter<T>(parameterName, numElements, numElementsPerThread, true, false, false,false,false);
 		}
 
+		// creates input array for stencil kernels. Devices get their own elements plus haloElements neighboring elements on each side (at same indices as on host)
+		// upload volume is close to one copy of the array instead of one copy per device (createArrayInput)
+		template<typename T>
+		HostParameter createArrayInputWithHalo(std::string parameterName, size_t numElements, size_t haloElements, size_t numElementsPerThread = 1)
+		{
+			return createHostParameter<T>(parameterName, numElements, numElementsPerThread, true, false, false, false, false, false, haloElements);
+		}
+
 		// creates output array. Devices copy only their own elements to the output because of possible race-conditions
 		// works like createArrayInputLoadBalanced except for the output
 		template<typename T>
@@ -114,6 +377,73 @@ namespace GPGPU
 			return createHostParameter<T>(parameterName, numElements, numElementsPerThread, false, true, false,false,false);
 		}
 
+		// out-of-core arrays: devices only hold tiles of them (computeOutOfCore), so they can be bigger than device memory
+		template<typename T>
+		HostParameter createArrayInputOutOfCore(std::string parameterName, size_t numElements, size_t numElementsPerThread = 1)
+		{
+			finishPendingCompute();
+			hostParameters[parameterName] = HostParameter(parameterName, numElements, sizeof(T), numElementsPerThread, true, false, false, false, false, false, 0, memoryPolicyForNewParameter(), "", true, pinnedContextForNewParameter());
+			registerHostParameter(parameterName);
+			return hostParameters[parameterName];
+		}
+
+		template<typename T>
+		HostParameter createArrayOutputOutOfCore(std::string parameterName, size_t numElements, size_t numElementsPerThread = 1)
+		{
+			finishPendingCompute();
+			hostParameters[parameterName] = HostParameter(parameterName, numElements, sizeof(T), numElementsPerThread, false, true, false, false, false, false, 0, memoryPolicyForNewParameter(), "", true, pinnedContextForNewParameter());
+			registerHostParameter(parameterName);
+			return hostParameters[parameterName];
+		}
+
+		template<typename T>
+		HostParameter createArrayInputOutputOutOfCore(std::string parameterName, size_t numElements, size_t numElementsPerThread = 1)
+		{
+			finishPendingCompute();
+			hostParameters[parameterName] = HostParameter(parameterName, numElements, sizeof(T), numElementsPerThread, true, true, false, false, false, false, 0, memoryPolicyForNewParameter(), "", true, pinnedContextForNewParameter());
+			registerHostParameter(parameterName);
+			return hostParameters[parameterName];
+		}
+
+		/*
+			creates load-balanced input array that is a memory-mapped file (number of elements = file size / sizeof(T)), file is not read into a separate copy
+			pages are read from page cache when host or a zero-copy device (CPU, iGPU) touches them, host writes to the array are not written to file
+			outOfCore = true: devices only hold tiles of it (computeOutOfCore)
+		*/
+		template<typename T>
+		HostParameter createArrayInputFromFile(std::string parameterName, std::string filePath, size_t numElementsPerThread = 1, bool outOfCore = false)
+		{
+			finishPendingCompute();
+			const size_t numElements = GPGPU_LIB::HostMemoryPool::fileBytes(filePath) / sizeof(T);
+			if (numElements == 0)
+			{
+				throw std::invalid_argument(std::string("error: file is smaller than one element: ") + filePath);
+			}
+			hostParameters[parameterName] = HostParameter(parameterName, numElements, sizeof(T), numElementsPerThread, true, false, false, false, false, false, 0, nullptr, filePath, outOfCore);
+			registerHostParameter(parameterName);
+			return hostParameters[parameterName];
+		}
+
+		// creates output array (like createArrayOutput) that is a memory-mapped file of numElements elements, file is created or truncated
+		// results downloaded by devices are written to file by the system, file is complete when last handle of the parameter is destroyed
+		// outOfCore = true: devices only hold tiles of it (computeOutOfCore)
+		template<typename T>
+		HostParameter createArrayOutputToFile(std::string parameterName, std::string filePath, size_t numElements, size_t numElementsPerThread = 1, bool outOfCore = false)
+		{
+			finishPendingCompute();
+			hostParameters[parameterName] = HostParameter(parameterName, numElements, sizeof(T), numElementsPerThread, false, true, false, false, false, false, 0, nullptr, filePath, outOfCore);
+			registerHostParameter(parameterName);
+			return hostParameters[parameterName];
+		}
+
+
+		// creates array that is updated in place. Devices get only their own elements and copy back only their own elements.
+		// one host buffer and one device buffer instead of an input and an output array
+		template<typename T>
+		HostParameter createArrayInputOutput(std::string parameterName, size_t numElements, size_t numElementsPerThread = 1)
+		{
+			return createHostParameter<T>(parameterName, numElements, numElementsPerThread, true, true, false, false, false);
+		}
 
 		// creates output array. Devices copy all elements and has race-condition when num devices > 1
 		// works like createArrayInput except for the output
@@ -130,6 +460,165 @@ namespace GPGPU
 			return createHostParameter<T>(parameterName, numElements, numElementsPerThread, false, false, false,false,false);
 		}
 
+		/*
+			creates array that stays on devices between runs and is copied only by syncToHost() / syncToDevices()
+			each device remembers the ranges (numElementsPerThread elements per work-item) that its kernels computed until syncToDevices(), syncToHost() downloads the newest range of each element
+			when work split changes between runs, parts of a device's new range that another device computed last are copied to it (through host) before the run
+			every kernel that has the array bound is recorded as writer of its work-items' ranges (also if it only reads them, then its device's copy is already newest)
+			a kernel reading elements outside of its work-items' own ranges needs syncToHost() + syncToDevices() between runs when there are multiple devices
+			not supported by streams (createStream)
+		*/
+		template<typename T>
+		HostParameter createArrayResident(std::string parameterName, size_t numElements, size_t numElementsPerThread = 1)
+		{
+			return createHostParameter<T>(parameterName, numElements, numElementsPerThread, false, false, false, false, false, true);
+		}
+
+		/*
+			creates reduction array (sum, min, max, histogram, ...) of numElements elements
+			each device works on its own private copy that starts with identity values, after each run host array becomes combination of all devices' copies
+			combine(T& accumulator, const T& partial) merges a device's element into host element, only numElements elements per device are copied
+			runs that use a reduction array replace its host values (they do not accumulate into previous host values)
+			kernels update elements with atomics or work-group reductions (work-items of a device share its copy)
+			not supported by streams (createStream)
+		*/
+		template<typename T, typename Combine>
+		HostParameter createReduction(std::string parameterName, size_t numElements, T identity, Combine combine)
+		{
+			finishPendingCompute();
+			HostParameter prm(parameterName, numElements, sizeof(T), 1, false, false, false, false, false, false, 0, memoryPolicyForNewParameter());
+			prm.reductionIdentity = std::make_shared<std::vector<int8_t>>(sizeof(T));
+			std::copy(reinterpret_cast<const int8_t*>(&identity), reinterpret_cast<const int8_t*>(&identity) + sizeof(T), prm.reductionIdentity->begin());
+
+			// simple loop over contiguous elements, compiler vectorizes it for arithmetic combiners
+			prm.reductionCombiner = [combine](int8_t* accumulator, const int8_t* partial, size_t num) {
+				T* acc = reinterpret_cast<T*>(accumulator);
+				const T* par = reinterpret_cast<const T*>(partial);
+				for (size_t i = 0; i < num; i++)
+					combine(acc[i], par[i]);
+			};
+			hostParameters[parameterName] = prm;
+			for (size_t i = 0; i < numElements; i++)
+				hostParameters[parameterName].access<T>(i) = identity;
+			registerHostParameter(parameterName);
+			reductionParameterIds.insert(hostParameters[parameterName].id);
+			return hostParameters[parameterName];
+		}
+
+		/*
+			creates append buffer for kernels with unknown number of results (filtering, compaction)
+			binds as two kernel arguments: elements (__global T*) and a counter (__global uint*) that is reset to zero on each device before a run
+			kernel appends with: uint i = atomic_inc(counter); if (i < capacity) elements[i] = value;
+			each device has its own buffer of capacity elements, only appended elements are downloaded
+			after a run, host array has appended elements of all devices one after another in device order (getAppendCounts() gives the segments)
+			elements that do not fit in a device's capacity, or in host array after previous devices' elements, are dropped (getAppendCounts(prm, true) tells how many were tried)
+			not supported by streams (createStream)
+		*/
+		template<typename T>
+		HostParameter createAppendBuffer(std::string parameterName, size_t capacity)
+		{
+			finishPendingCompute();
+			HostParameter counter(parameterName + "#count", 1, sizeof(cl_uint), 1, false, false, false, false, false);
+			counter.appendCounterOp = true;
+			hostParameters[counter.name] = counter;
+			registerHostParameter(counter.name);
+			counter = hostParameters[counter.name];
+			HostParameter prm(parameterName, capacity, sizeof(T), 1, false, false, false, false, false, false, 0, memoryPolicyForNewParameter());
+			prm.appendCounterId = counter.id;
+			prm.prmList.push_back(prm.appendCounterName());
+			hostParameters[parameterName] = prm;
+			registerHostParameter(parameterName);
+			appendParameterIds.insert(hostParameters[parameterName].id);
+			return hostParameters[parameterName];
+		}
+
+		// number of elements appended by each device in last run that used an append buffer (on the same order their names appear on deviceNames())
+		// device i's elements start at sum of counts of devices before it
+		// requested = true: number of appends each device tried (counter values), elements were dropped if any of them is bigger than its count
+		std::vector<size_t> getAppendCounts(GPGPU::HostParameter prm, bool requested = false);
+
+		// creates reduction array with a built-in combiner: REDUCE_SUM, REDUCE_MIN or REDUCE_MAX
+		template<typename T>
+		HostParameter createReduction(std::string parameterName, size_t numElements, int reduceOp)
+		{
+			if (reduceOp == REDUCE_SUM)
+				return createReduction<T>(parameterName, numElements, T(0), [](T& acc, const T& val) { acc += val; });
+
+			const T highest = std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+			const T lowest = std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+			if (reduceOp == REDUCE_MIN)
+				return createReduction<T>(parameterName, numElements, highest, [](T& acc, const T& val) { acc = (val < acc ? val : acc); });
+			if (reduceOp == REDUCE_MAX)
+				return createReduction<T>(parameterName, numElements, lowest, [](T& acc, const T& val) { acc = (val > acc ? val : acc); });
+			throw std::invalid_argument(std::string("error: unknown reduction: ") + std::to_string(reduceOp));
+		}
+
+		// downloads elements of a resident parameter computed since last syncToDevices() (each element from the device that computed it last)
+		// devices keep their own copies, later runs still move elements that change owner between devices
+		void syncToHost(GPGPU::HostParameter prm);
+
+		// uploads all elements of a resident parameter from host to all devices (then devices have equal copies and forget which ranges they computed)
+		void syncToDevices(GPGPU::HostParameter prm);
+
+		// selects load-balancing mode of run() and runMultiple(): LOAD_BALANCE_RATIO (default) or LOAD_BALANCE_AFFINE
+		// affine mode is better when size of work changes between calls (fixed costs like launch latency and transfer setup dominate small runs of discrete GPUs)
+		void setLoadBalancingMode(int mode);
+
+		// selects chunk scheduler of fine-grained load-balancing: FINE_GRAIN_SHARED_QUEUE (default), FINE_GRAIN_WORK_STEALING or FINE_GRAIN_GUIDED
+		// work stealing has less lock contention for small chunks and many devices (or clones)
+		// guided has fewer chunks (less copy/sync overhead) for same tail balance, loadSize becomes the minimum chunk size
+		void setFineGrainedScheduler(int scheduler);
+
+		/*
+			enabled=true: run() and runMultiple() leave a device out when the cost model (t = fixed cost + per-item cost * work) predicts that giving it even a single work-group makes the run finish later
+				by default every device gets at least one work-group, which adds full launch/transfer latency of slowest device to every run
+			reprobeEveryNthRun: a left-out device is given work once in this many runs of a kernel to update its measurements. 0 = never re-probe
+			cost model needs at least 2 runs of a kernel, exclusion starts after that
+		*/
+		void setDeviceExclusion(bool enabled, int reprobeEveryNthRun = 32);
+
+		/*
+			chunksPerDevice > 1: run() splits range of each device into that many sub-chunks (multiples of work-group size) and uses separate upload, compute and download queues of same context
+				so that copy of next/previous sub-chunk overlaps kernel of current sub-chunk
+				this gives the I/O overlap of clonesPerDevice without extra contexts, worker threads and device buffers
+			whole-array inputs/outputs are copied only once per run. runMultiple() and fine-grained load-balancing are not affected
+			1 = disabled (default)
+		*/
+		void setOverlapChunks(int chunksPerDevice);
+
+		/*
+			number of chunks that each device keeps enqueued during fine-grained load-balancing (default 2)
+			a device waits for its oldest chunk (instead of finishing its queue after every chunk) before taking another chunk, so there is no idle gap between chunks
+			higher values hide more latency but a device takes chunks before it can start them, which makes the tail less balanced
+			1 = each chunk is completed before next one is taken
+		*/
+		void setFineGrainedPipelineDepth(int chunksInFlight);
+
+		/*
+			host parameters take page-aligned blocks from a process-wide pool and return them when last handle of a parameter is destroyed, so re-creating parameters does not go to system allocator
+			prefault=true: newly allocated blocks are touched page by page once (first runs do not pay page-fault costs)
+			maxCachedBytes: total size of released blocks kept for reuse (default 1 GB)
+		*/
+		void setHostMemoryOptions(bool prefault, size_t maxCachedBytes = (size_t)1024 * 1024 * 1024);
+
+		/*
+			page size and NUMA placement of host parameters created after this call (Linux only, other systems ignore it)
+			hugePages: HOST_HUGE_PAGES_NONE, HOST_HUGE_PAGES_TRANSPARENT (kernel merges pages into 2 MB pages when it can) or HOST_HUGE_PAGES_EXPLICIT (pre-reserved 2 MB pages, creating a parameter throws if there are not enough)
+			numaPolicy: HOST_NUMA_DEFAULT (first touch), HOST_NUMA_INTERLEAVE (pages round-robin over all nodes), HOST_NUMA_BIND (all pages on numaNode)
+				or HOST_NUMA_SPLIT_BY_DEVICES (each device's region of the array, by last work ratios of run() or evenly before first run, prefers NUMA node of that device's PCI slot)
+			parameters with a non-default policy are mapped separately instead of being taken from pool of setHostMemoryOptions
+		*/
+		void setHostMemoryPolicy(int hugePages, int numaPolicy, int numaNode = 0);
+
+		/*
+			enabled=true: host arrays of parameters created after this call are page-locked memory (CL_MEM_ALLOC_HOST_PTR) of first device that does not share RAM, mapped once
+			copies of that device run as DMA transfers at full bus bandwidth instead of going through a staging copy of the driver
+			other discrete devices (with their own contexts) may still see it as pageable memory, RAM-sharing devices use it zero-copy as before
+			does nothing if all devices share RAM. memory-mapped files and parameters with a non-default setHostMemoryPolicy are not pinned
+			page-locked memory can not be swapped, pinning too much of RAM slows down the system
+		*/
+		void setPinnedHostMemory(bool enabled);
+
 		// binds a parameter to a kernel at parameterPosition-th position
 		void setKernelParameter(std::string kernelName, std::string parameterName, int parameterPosition);
 
@@ -142,6 +631,9 @@ namespace GPGPU
 			returns workload ratios of devices (on the same order their names appear on deviceNames())
 		*/
 		std::vector<double> run(std::string kernelName, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads);
+
+		// same as run but with kernel handle returned from compile()
+		std::vector<double> run(int kernelId, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads);
 		std::vector<double> runMultiple(std::vector<std::string> kernelNames, size_t offsetElement, size_t numGlobalThreads, size_t numLocalThreads);
 
 		// works same as run with default parameters of fineGrainedLoadBalancing = false and fineGrainSize = 0
@@ -164,8 +656,94 @@ namespace GPGPU
 			bool fineGrainedLoadBalancing = false,
 			size_t fineGrainSize = 0);
 
+		/*
+			same as compute but returns without waiting for devices so that host can prepare next work while devices compute
+			handle.wait() returns workload ratios of devices
+			next call to any method of Computer that uses devices (compute, run, setKernelParameter, createHostParameter, ...) waits for this computation first
+		*/
+		ComputeHandle computeAsync(
+			GPGPU::HostParameter prm,
+			std::string kernelName,
+			size_t offsetElement,
+			size_t numGlobalThreads,
+			size_t numLocalThreads,
+			bool fineGrainedLoadBalancing = false,
+			size_t fineGrainSize = 0);
+
+		// same as computeMultiple but returns without waiting for devices
+		// with fineGrainedLoadBalancing=true, only the last kernel runs asynchronously because all devices need to complete a kernel before next kernel starts
+		ComputeHandle computeMultipleAsync(
+			std::vector<GPGPU::HostParameter> prm,
+			std::vector<std::string> kernelName,
+			size_t offsetElement,
+			size_t numGlobalThreads,
+			size_t numLocalThreads,
+			bool fineGrainedLoadBalancing = false,
+			size_t fineGrainSize = 0);
+
+		/*
+			computes arrays that do not fit in device memory: range is cut into tiles of tileThreads work-items that devices take from a shared queue (fine-grained load-balancing)
+			a device streams each tile through a few tile-sized buffers so that upload of next tile and download of previous tile overlap kernel of current tile
+			kernel sees work-items of a tile as 0, 1, ..., tileThreads - 1 (get_global_id(0) is relative to tile) and indexes out-of-core parameters with them, element-wise kernels need no change
+			all load-balanced parameters must be out-of-core (createArrayInputOutOfCore, createArrayOutputOutOfCore, createArrayInputOutputOutOfCore), whole-array inputs/outputs, scalars, reductions and append buffers work as usual
+			whole-array inputs are uploaded with first tile of a device, whole-array outputs are downloaded once after kernels of all its tiles
+			device memory per out-of-core parameter is 3 x tileThreads x numElementsPerThread elements
+		*/
+		std::vector<double> computeOutOfCore(
+			GPGPU::HostParameter prm,
+			std::string kernelName,
+			size_t offsetElement,
+			size_t numGlobalThreads,
+			size_t numLocalThreads,
+			size_t tileThreads);
+
+		/*
+			creates a pipeline of repeated compute calls of a kernel with numBufferSets copies of its input/output parameters
+			while host prepares a buffer set, other sets are uploaded, computed and downloaded concurrently on all devices
+			prm, kernelName, offsetElement, numGlobalThreads, numLocalThreads: same as compute (fine-grained load-balancing is not used)
+			work ratios start from kernel's load-balancing state and are updated from device-side durations of completed batches
+		*/
+		ComputeStream createStream(
+			GPGPU::HostParameter prm,
+			std::string kernelName,
+			size_t offsetElement,
+			size_t numGlobalThreads,
+			size_t numLocalThreads,
+			int numBufferSets = 2);
+
+		/*
+			validates and binds a compute call once so that its repeated launches skip parameter lookups and binding checks
+			prm, kernelName, offsetElement, numGlobalThreads, numLocalThreads, fineGrainedLoadBalancing, fineGrainSize: same as compute
+			throws if kernel is not compiled, a parameter does not exist, range is not a multiple of numLocalThreads or does not fit in a load-balanced parameter
+		*/
+		LaunchPlan createLaunchPlan(
+			GPGPU::HostParameter prm,
+			std::string kernelName,
+			size_t offsetElement,
+			size_t numGlobalThreads,
+			size_t numLocalThreads,
+			bool fineGrainedLoadBalancing = false,
+			size_t fineGrainSize = 0);
+
 		// returns list of device names with their opencl version support
 		std::vector<std::string> deviceNames(bool detailed = true);
+
+		// returns time breakdown of last run of a kernel (or space-separated kernel names of runMultiple) for each device (on the same order their names appear on deviceNames())
+		// a PCIe-bound device has high upload/download time, a compute-bound device has high kernel time
+		std::vector<DeviceTimings> getDeviceTimings(std::string kernelName);
+
+		/*
+			saves load-balancing state (work ratios, ratio history, last benchmarks of devices, cost model samples) of all compiled kernels to a file
+			the file is keyed by device signature and kernel source hashes so that it is only applied to same devices and same kernels
+		*/
+		void saveLoadBalanceProfile(std::string fileName);
+
+		/*
+			loads load-balancing state written by saveLoadBalanceProfile so that first run of a kernel uses the converged work distribution instead of an even split
+			kernels need to be compiled before loading. kernels with changed source code are skipped.
+			returns false if file does not exist or if it was saved for a different set of devices
+		*/
+		bool loadLoadBalanceProfile(std::string fileName);
 	};
 }
 #endif // !GPGPU_COMPUTER_LIB
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "device.h"
+#include <fstream>
+#include <cstdio>
 namespace GPGPU_LIB
 {
 	Device::Device(cl::Device dev, int idPrm, bool sharesRAMPrm, bool isCPUPrm )
@@ -7,6 +9,7 @@ namespace GPGPU_LIB
 		device = dev;
 		id = idPrm;
 		isCPU = isCPUPrm;
+		numaNode = -1;
 		cl_int op;
 		if (id != -1)
 		{
@@ -55,6 +58,20 @@ namespace GPGPU_LIB
 					ver = 120;
 			}
 
+#if defined(__linux__) && defined(CL_DEVICE_PCI_BUS_INFO_KHR)
+			// device is attached to the socket of its PCI root (optional extension, unknown if not supported)
+			cl_device_pci_bus_info_khr pciInfo;
+			if (!isCPU && clGetDeviceInfo(device(), CL_DEVICE_PCI_BUS_INFO_KHR, sizeof(pciInfo), &pciInfo, nullptr) == CL_SUCCESS)
+			{
+				char path[128];
+				snprintf(path, sizeof(path), "/sys/bus/pci/devices/%04x:%02x:%02x.%x/numa_node", pciInfo.pci_domain, pciInfo.pci_bus, pciInfo.pci_device, pciInfo.pci_function);
+				std::ifstream file(path);
+				int node = -1;
+				if (file >> node)
+					numaNode = node;
+			}
+#endif
+
 		}
 		else
 		{
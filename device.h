@@ -15,6 +15,9 @@ namespace GPGPU_LIB
 		bool sharesRAM;
 		bool isCPU;
 
+		// NUMA node of the device's PCI slot (from cl_khr_pci_bus_info and sysfs), -1 if unknown or CPU device
+		int numaNode;
+
 		std::string simpleName;
 		std::string name;
 		std::string halfFpConfig;
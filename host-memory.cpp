@@ -0,0 +1,374 @@
+#include "host-memory.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sstream>
+#endif
+
+namespace GPGPU_LIB
+{
+	static int8_t* allocatePages(size_t numBytes)
+	{
+		void* block = nullptr;
+#ifdef _WIN32
+		block = _aligned_malloc(numBytes, HostMemoryPool::pageSize);
+#else
+		if (posix_memalign(&block, HostMemoryPool::pageSize, numBytes) != 0)
+			block = nullptr;
+#endif
+		if (block == nullptr)
+		{
+			throw std::invalid_argument(std::string("error: can not allocate host memory of bytes: ") + std::to_string(numBytes));
+		}
+		return reinterpret_cast<int8_t*>(block);
+	}
+
+	static void freePages(int8_t* block)
+	{
+#ifdef _WIN32
+		_aligned_free(block);
+#else
+		free(block);
+#endif
+	}
+
+	std::shared_ptr<HostMemoryPool> HostMemoryPool::instance()
+	{
+		static std::shared_ptr<HostMemoryPool> pool = std::make_shared<HostMemoryPool>();
+		return pool;
+	}
+
+	HostMemoryPool::HostMemoryPool() :cachedBytes(0), cacheLimit((size_t)1024 * 1024 * 1024), prefaultPages(false)
+	{
+
+	}
+
+	HostMemoryPool::~HostMemoryPool()
+	{
+		for (auto& sizeClassBlocks : freeBlocks)
+		{
+			for (int8_t* block : sizeClassBlocks.second)
+				freePages(block);
+		}
+	}
+
+	size_t HostMemoryPool::sizeClass(size_t numBytes)
+	{
+		const size_t pages = (numBytes + pageSize - 1) / pageSize;
+		if (pages <= 4)
+			return (pages == 0 ? 1 : pages) * pageSize;
+
+		// 4 classes per power of 2: wastes at most 25% of a block
+		size_t power = 4;
+		while (power * 2 <= pages)
+			power *= 2;
+		const size_t step = power / 4;
+		return ((pages + step - 1) / step) * step * pageSize;
+	}
+
+	int8_t* HostMemoryPool::allocate(size_t numBytes, size_t& blockBytes)
+	{
+		blockBytes = sizeClass(numBytes);
+		bool prefault;
+		{
+			std::lock_guard<std::mutex> lg(sync);
+			auto it = freeBlocks.find(blockBytes);
+			if (it != freeBlocks.end() && !it->second.empty())
+			{
+				int8_t* block = it->second.back();
+				it->second.pop_back();
+				cachedBytes -= blockBytes;
+				return block;
+			}
+			prefault = prefaultPages;
+		}
+
+		int8_t* block = allocatePages(blockBytes);
+		if (prefault)
+		{
+			for (size_t i = 0; i < blockBytes; i += pageSize)
+				block[i] = 0;
+		}
+		return block;
+	}
+
+	void HostMemoryPool::release(int8_t* block, size_t blockBytes)
+	{
+		{
+			std::lock_guard<std::mutex> lg(sync);
+			if (cachedBytes + blockBytes <= cacheLimit)
+			{
+				freeBlocks[blockBytes].push_back(block);
+				cachedBytes += blockBytes;
+				return;
+			}
+		}
+		freePages(block);
+	}
+
+	void HostMemoryPool::setPrefault(bool prefault)
+	{
+		std::lock_guard<std::mutex> lg(sync);
+		prefaultPages = prefault;
+	}
+
+	void HostMemoryPool::setCacheLimit(size_t maxCachedBytes)
+	{
+		std::vector<int8_t*> excess;
+		{
+			std::lock_guard<std::mutex> lg(sync);
+			cacheLimit = maxCachedBytes;
+
+			// biggest blocks are released first
+			for (auto it = freeBlocks.rbegin(); it != freeBlocks.rend() && cachedBytes > cacheLimit; ++it)
+			{
+				while (!it->second.empty() && cachedBytes > cacheLimit)
+				{
+					excess.push_back(it->second.back());
+					it->second.pop_back();
+					cachedBytes -= it->first;
+				}
+			}
+		}
+
+		for (int8_t* block : excess)
+			freePages(block);
+	}
+
+#ifdef __linux__
+	// memory policy modes of mbind (numaif.h, not included to avoid dependency on libnuma)
+	const static int MPOL_PREFERRED_MODE = 1;
+	const static int MPOL_BIND_MODE = 2;
+	const static int MPOL_INTERLEAVE_MODE = 3;
+	const static size_t hugePageSize = 2 * 1024 * 1024;
+	const static int maxNumaNodes = 1024;
+
+	// nodes listed in /sys/devices/system/node/online such as "0-1,3"
+	static std::vector<int> onlineNumaNodes()
+	{
+		std::vector<int> nodes;
+		std::ifstream file("/sys/devices/system/node/online");
+		std::string list;
+		if (!(file >> list))
+			return nodes;
+
+		std::stringstream ranges(list);
+		std::string range;
+		while (std::getline(ranges, range, ','))
+		{
+			const size_t dash = range.find('-');
+			const int first = std::stoi(range.substr(0, dash));
+			const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+			for (int node = first; node <= last && node < maxNumaNodes; node++)
+				nodes.push_back(node);
+		}
+		return nodes;
+	}
+
+	// applies a memory policy to pages of [begin, begin + numBytes) before they are touched, failures leave default placement
+	static void bindPages(int8_t* begin, size_t numBytes, int mode, const std::vector<int>& nodes)
+	{
+		if (numBytes == 0 || nodes.empty())
+			return;
+
+		std::vector<unsigned long> mask(maxNumaNodes / (8 * sizeof(unsigned long)), 0);
+		for (int node : nodes)
+		{
+			if (node >= 0 && node < maxNumaNodes)
+				mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+		}
+		syscall(SYS_mbind, begin, numBytes, mode, mask.data(), (unsigned long)maxNumaNodes, 0u);
+	}
+#endif
+
+	int8_t* HostMemoryPool::allocate(size_t numBytes, const HostMemoryPolicy& policy, size_t& blockBytes)
+	{
+#ifdef __linux__
+		if (policy.isDefault())
+			return allocate(numBytes, blockBytes);
+
+		const size_t granularity = (policy.hugePages == HostMemoryPolicy::HUGE_PAGES_NONE) ? pageSize : hugePageSize;
+		blockBytes = ((numBytes + granularity - 1) / granularity) * granularity;
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+		if (policy.hugePages == HostMemoryPolicy::HUGE_PAGES_EXPLICIT)
+			flags |= MAP_HUGETLB;
+
+		void* mapped = mmap(nullptr, blockBytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (mapped == MAP_FAILED)
+		{
+			throw std::invalid_argument(std::string("error: can not map host memory with requested page size, bytes: ") + std::to_string(blockBytes));
+		}
+		int8_t* block = reinterpret_cast<int8_t*>(mapped);
+
+		if (policy.hugePages == HostMemoryPolicy::HUGE_PAGES_TRANSPARENT)
+			madvise(mapped, blockBytes, MADV_HUGEPAGE);
+
+		if (policy.numaPolicy == HostMemoryPolicy::NUMA_INTERLEAVE)
+		{
+			bindPages(block, blockBytes, MPOL_INTERLEAVE_MODE, onlineNumaNodes());
+		}
+		else if (policy.numaPolicy == HostMemoryPolicy::NUMA_BIND)
+		{
+			bindPages(block, blockBytes, MPOL_BIND_MODE, std::vector<int>{ policy.numaNode });
+		}
+		else if (policy.numaPolicy == HostMemoryPolicy::NUMA_SPLIT_BY_DEVICES)
+		{
+			// region boundaries are rounded to pages, a page on a boundary belongs to the earlier region
+			size_t begin = 0;
+			for (auto& segment : policy.segments)
+			{
+				size_t end = (size_t)(segment.first * numBytes);
+				end = std::min(((end + granularity - 1) / granularity) * granularity, blockBytes);
+				if (end > begin && segment.second >= 0)
+					bindPages(block + begin, end - begin, MPOL_PREFERRED_MODE, std::vector<int>{ segment.second });
+				begin = std::max(begin, end);
+			}
+		}
+
+		bool prefault;
+		{
+			std::lock_guard<std::mutex> lg(sync);
+			prefault = prefaultPages;
+		}
+
+		// pages are placed by the policy when they are first touched
+		if (prefault)
+		{
+			for (size_t i = 0; i < blockBytes; i += pageSize)
+				block[i] = 0;
+		}
+		return block;
+#else
+		return allocate(numBytes, blockBytes);
+#endif
+	}
+
+	void HostMemoryPool::release(int8_t* block, size_t blockBytes, const HostMemoryPolicy& policy)
+	{
+#ifdef __linux__
+		if (!policy.isDefault())
+		{
+			munmap(block, blockBytes);
+			return;
+		}
+#endif
+		release(block, blockBytes);
+	}
+
+	size_t HostMemoryPool::fileBytes(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			throw std::invalid_argument(std::string("error: can not open file: ") + path);
+		}
+		return (size_t)file.tellg();
+	}
+
+	int8_t* HostMemoryPool::mapFile(const std::string& path, size_t fileBytes, size_t numBytes, bool writeBack, size_t& blockBytes)
+	{
+#ifndef _WIN32
+		const int fd = writeBack ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			throw std::invalid_argument(std::string("error: can not open file for mapping: ") + path);
+		}
+
+		if (writeBack && ftruncate(fd, (off_t)fileBytes) != 0)
+		{
+			close(fd);
+			throw std::invalid_argument(std::string("error: can not resize file: ") + path);
+		}
+
+		bool prefault;
+		{
+			std::lock_guard<std::mutex> lg(sync);
+			prefault = prefaultPages;
+		}
+
+		// anonymous reservation for the whole block (padding after file is zero-filled), then file is mapped over its beginning
+		blockBytes = ((numBytes + pageSize - 1) / pageSize) * pageSize;
+		void* reserved = mmap(nullptr, blockBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (reserved == MAP_FAILED)
+		{
+			close(fd);
+			throw std::invalid_argument(std::string("error: can not reserve host memory for file: ") + path);
+		}
+
+		if (fileBytes > 0)
+		{
+			int flags = (writeBack ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED;
+#ifdef MAP_POPULATE
+			// prefaulting by touching would copy private pages, populate reads them from page cache instead
+			if (prefault)
+				flags |= MAP_POPULATE;
+#endif
+			void* mapped = mmap(reserved, fileBytes, PROT_READ | PROT_WRITE, flags, fd, 0);
+			if (mapped == MAP_FAILED)
+			{
+				munmap(reserved, blockBytes);
+				close(fd);
+				throw std::invalid_argument(std::string("error: can not map file: ") + path);
+			}
+		}
+
+		// mapping keeps file open
+		close(fd);
+		return reinterpret_cast<int8_t*>(reserved);
+#else
+		int8_t* block = allocate(numBytes, blockBytes);
+		std::fill(block, block + blockBytes, 0);
+		if (writeBack)
+		{
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			if (!file)
+			{
+				release(block, blockBytes);
+				throw std::invalid_argument(std::string("error: can not create file: ") + path);
+			}
+		}
+		else
+		{
+			std::ifstream file(path, std::ios::binary);
+			if (!file || !file.read(reinterpret_cast<char*>(block), fileBytes))
+			{
+				release(block, blockBytes);
+				throw std::invalid_argument(std::string("error: can not read file: ") + path);
+			}
+		}
+		return block;
+#endif
+	}
+
+	void HostMemoryPool::unmapFile(int8_t* block, size_t blockBytes, const std::string& path, size_t fileBytes, bool writeBack)
+	{
+#ifndef _WIN32
+		// dirty pages of a shared mapping are already file's pages
+		(void)path;
+		(void)fileBytes;
+		(void)writeBack;
+		munmap(block, blockBytes);
+#else
+		// destructors can not throw, an unwritable file loses the results
+		if (writeBack)
+		{
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char*>(block), fileBytes);
+		}
+		release(block, blockBytes);
+#endif
+	}
+}
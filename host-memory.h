@@ -0,0 +1,102 @@
+#pragma once
+#ifndef GPGPU_HOST_MEMORY_LIB
+#define GPGPU_HOST_MEMORY_LIB
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+namespace GPGPU_LIB
+{
+	// page size and placement of a host parameter's memory (Linux only, ignored on other systems)
+	struct HostMemoryPolicy
+	{
+		const static int HUGE_PAGES_NONE = 0;
+		// transparent huge pages (madvise), falls back to normal pages silently
+		const static int HUGE_PAGES_TRANSPARENT = 1;
+		// pre-reserved huge pages (MAP_HUGETLB), allocation throws if there are not enough of them
+		const static int HUGE_PAGES_EXPLICIT = 2;
+
+		// first-touch placement
+		const static int NUMA_DEFAULT = 0;
+		// pages are spread over all nodes round-robin
+		const static int NUMA_INTERLEAVE = 1;
+		// all pages on numaNode
+		const static int NUMA_BIND = 2;
+		// consecutive regions of array on nodes of devices that compute them (segments)
+		const static int NUMA_SPLIT_BY_DEVICES = 3;
+
+		int hugePages;
+		int numaPolicy;
+		int numaNode;
+
+		// NUMA_SPLIT_BY_DEVICES: (end fraction of array, node) for each region in order, node -1 = first-touch
+		std::vector<std::pair<double, int>> segments;
+
+		HostMemoryPolicy() :hugePages(HUGE_PAGES_NONE), numaPolicy(NUMA_DEFAULT), numaNode(0) {}
+
+		bool isDefault() const { return hugePages == HUGE_PAGES_NONE && numaPolicy == NUMA_DEFAULT; }
+	};
+
+	/*
+		process-wide arena of page-aligned host memory blocks for host parameters
+		block sizes are rounded up to size classes (1, 1.25, 1.5, 1.75 x power of 2 pages) so that a re-created parameter of a similar size reuses a released block
+		released blocks are kept in free lists of their size class (up to a cache limit) instead of going back to system allocator
+	*/
+	struct HostMemoryPool
+	{
+		const static size_t pageSize = 4096;
+
+		// shared by all host parameters, released blocks keep it alive until last one is returned
+		static std::shared_ptr<HostMemoryPool> instance();
+
+		// returns a page-aligned block of at least numBytes bytes (size is a multiple of page size) and its actual size
+		int8_t* allocate(size_t numBytes, size_t& blockBytes);
+
+		// returns block to free list of its size class (or to system if cache limit is exceeded)
+		void release(int8_t* block, size_t blockBytes);
+
+		// prefault=true: newly allocated blocks are touched page by page so that first use by host or by a zero-copy device does not page-fault
+		void setPrefault(bool prefault);
+
+		// maximum total bytes of free blocks kept for reuse
+		void setCacheLimit(size_t maxCachedBytes);
+
+		// returns a block that is mapped separately with given page size and NUMA placement (not pooled, because placement differs between parameters)
+		// same as allocate() for default policy or on systems other than Linux
+		int8_t* allocate(size_t numBytes, const HostMemoryPolicy& policy, size_t& blockBytes);
+
+		// releases a block from allocate(numBytes, policy, blockBytes)
+		void release(int8_t* block, size_t blockBytes, const HostMemoryPolicy& policy);
+
+		// size of a file in bytes, throws if it can not be opened
+		static size_t fileBytes(const std::string& path);
+
+		/*
+			returns a page-aligned block of at least numBytes bytes whose first fileBytes bytes are the file (mmap), bytes after them are zero
+			writeBack=false: private mapping, pages are read from page cache when touched and host writes are not written to file
+			writeBack=true: file is created (or truncated) with fileBytes bytes and shared mapping writes host/device results to it
+			systems without mmap read the file into a pooled block (and write it back in unmapFile)
+		*/
+		int8_t* mapFile(const std::string& path, size_t fileBytes, size_t numBytes, bool writeBack, size_t& blockBytes);
+
+		// releases a block from mapFile (dirty pages of a write-back mapping are written to file by system)
+		void unmapFile(int8_t* block, size_t blockBytes, const std::string& path, size_t fileBytes, bool writeBack);
+
+		HostMemoryPool();
+		~HostMemoryPool();
+	private:
+		std::mutex sync;
+		std::map<size_t, std::vector<int8_t*>> freeBlocks;
+		size_t cachedBytes;
+		size_t cacheLimit;
+		bool prefaultPages;
+
+		// smallest size class that fits numBytes
+		static size_t sizeClass(size_t numBytes);
+	};
+}
+#endif // !GPGPU_HOST_MEMORY_LIB
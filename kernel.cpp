@@ -41,4 +41,23 @@ namespace GPGPU_LIB
 			}
 		}
 	}
+
+	Kernel Kernel::clone()
+	{
+		Kernel result = *this;
+		result.mapParameterIdToParameter.clear();
+		result.argumentPositions.clear();
+		result.tileArgumentPositions.clear();
+		cl_int op = CL_SUCCESS;
+		cl::Program program = kernel.getInfo<CL_KERNEL_PROGRAM>(&op);
+		if (op == CL_SUCCESS)
+		{
+			result.kernel = cl::Kernel(program, name.c_str(), &op);
+		}
+		if (op != CL_SUCCESS)
+		{
+			throw std::invalid_argument(std::string("kernel clone error: ") + getErrorString(op));
+		}
+		return result;
+	}
 }
\ No newline at end of file
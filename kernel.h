@@ -22,12 +22,21 @@ namespace GPGPU_LIB
 		std::string code;
 		Context context;
 		bool isRunning; // todo: check this before setting an argument (and wait) and set this before running
-		std::map<std::string, Parameter> mapParameterNameToParameter;
+		std::map<int, Parameter> mapParameterIdToParameter;
+
+		// argument positions of parameters (by parameter id), a parameter bound to a taken position replaces the old one in mapParameterIdToParameter
+		std::map<int, int> argumentPositions;
+
+		// argument positions of out-of-core parameters (by parameter id), they are bound to a tile slot before each tile
+		std::map<int, int> tileArgumentPositions;
 
 		/* compiles the given kernel code for the kernel name to be called later
 		 todo: add caching for binary code, probably not needed if driver has its own caching
 		 */
 		Kernel(Context con = Context(), std::string kernelCode = "", std::string kernelName = "");
+
+		// creates another kernel object from same compiled program, with its own (empty) argument bindings
+		Kernel clone();
 	};
 }
 #endif // !GPGPU_KERNEL_LIB
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "computer.h"
+
+namespace GPGPU
+{
+	LaunchPlan::LaunchPlan() :computer(nullptr), kernelId(-1), offsetElement(0), numGlobalThreads(0), numLocalThreads(0), fineGrainedLoadBalancing(false), fineGrainSize(0), bindingVersion(0)
+	{
+
+	}
+
+	std::vector<double> LaunchPlan::launch()
+	{
+		return launchAsync().wait();
+	}
+
+	ComputeHandle LaunchPlan::launchAsync()
+	{
+		if (computer == nullptr)
+		{
+			throw std::invalid_argument("launch plan is not created by a Computer");
+		}
+		return computer->launchPlan(*this);
+	}
+
+	LaunchPlan Computer::createLaunchPlan(
+		GPGPU::HostParameter prm,
+		std::string kernelName,
+		size_t offsetElement,
+		size_t numGlobalThreads,
+		size_t numLocalThreads,
+		bool fineGrainedLoadBalancing,
+		size_t fineGrainSize)
+	{
+		finishPendingCompute();
+		LaunchPlan plan;
+		plan.computer = this;
+		plan.kernelId = kernelIdOf(kernelName);
+		plan.kernelName = kernelName;
+		plan.offsetElement = offsetElement;
+		plan.numGlobalThreads = numGlobalThreads;
+		plan.numLocalThreads = numLocalThreads;
+		plan.fineGrainedLoadBalancing = fineGrainedLoadBalancing;
+		plan.fineGrainSize = (fineGrainSize == 0 ? numLocalThreads : fineGrainSize);
+
+		if (numLocalThreads == 0 || numGlobalThreads == 0 || numGlobalThreads % numLocalThreads != 0)
+		{
+			throw std::invalid_argument(std::string("error: number of global threads must be a non-zero multiple of number of local threads: ") + kernelName);
+		}
+
+		if (fineGrainedLoadBalancing && plan.fineGrainSize % numLocalThreads != 0)
+		{
+			throw std::invalid_argument(std::string("error: fine grain size must be a multiple of number of local threads: ") + kernelName);
+		}
+
+		for (int i = 0; i < prm.prmList.size(); i++)
+		{
+			const std::string& name = prm.prmList[i];
+			auto it = hostParameters.find(name);
+			if (it == hostParameters.end())
+			{
+				throw std::invalid_argument(std::string("error: parameter not found: ") + name);
+			}
+
+			// devices copy their own regions of load-balanced inputs/outputs, whole range has to fit in host array
+			const HostParameter& parameter = it->second;
+			const bool perThreadRegion = (parameter.readOp && !parameter.readAllOp) || (parameter.writeOp && !parameter.writeAllOp);
+			if (!parameter.scalar && perThreadRegion && (offsetElement + numGlobalThreads) * parameter.elementsPerThr > parameter.n)
+			{
+				throw std::invalid_argument(std::string("error: range of kernel ") + kernelName + " exceeds elements of parameter: " + name);
+			}
+
+			setKernelParameter(kernelName, name, i);
+			plan.parameterNames.push_back(name);
+		}
+		plan.bindingVersion = bindingVersions[plan.kernelId];
+		return plan;
+	}
+
+	ComputeHandle Computer::launchPlan(LaunchPlan& plan)
+	{
+		finishPendingCompute();
+
+		// another call may have bound other parameters to the kernel since last launch
+		if (bindingVersions[plan.kernelId] != plan.bindingVersion)
+		{
+			for (int i = 0; i < plan.parameterNames.size(); i++)
+			{
+				setKernelParameter(plan.kernelName, plan.parameterNames[i], i);
+			}
+			plan.bindingVersion = bindingVersions[plan.kernelId];
+		}
+
+		if (plan.fineGrainedLoadBalancing)
+			pendingCompute = startFineGrainedLoadBalancing(plan.kernelId, plan.offsetElement, plan.numGlobalThreads, plan.numLocalThreads, plan.fineGrainSize);
+		else
+			pendingCompute = startRun(plan.kernelId, std::vector<int>(), plan.offsetElement, plan.numGlobalThreads, plan.numLocalThreads);
+		return ComputeHandle(pendingCompute);
+	}
+}
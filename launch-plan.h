@@ -0,0 +1,53 @@
+#pragma once
+#ifndef GPGPU_LAUNCH_PLAN_LIB
+#define GPGPU_LAUNCH_PLAN_LIB
+
+#include "gpgpu_init.hpp"
+#include <string>
+#include <vector>
+namespace GPGPU
+{
+	struct Computer;
+	struct ComputeHandle;
+
+	/*
+		pre-validated and pre-bound compute call (Computer::createLaunchPlan)
+		kernel, parameter list, range and load-balancing mode are checked and bound once, launch() only balances work and gives it to devices
+
+		usage:
+			GPGPU::LaunchPlan plan = computer.createLaunchPlan(a.next(b), "kernelName", 0, n, 64);
+			for (...)
+				plan.launch();
+
+		if another call binds different parameters to the same kernel, next launch() binds the plan's parameters again
+		the plan must not be used after its Computer is destroyed
+	*/
+	struct LaunchPlan
+	{
+		friend struct Computer;
+	private:
+		Computer* computer;
+		int kernelId;
+		std::string kernelName;
+
+		// names of parameters in kernel argument order (for re-binding)
+		std::vector<std::string> parameterNames;
+		size_t offsetElement;
+		size_t numGlobalThreads;
+		size_t numLocalThreads;
+		bool fineGrainedLoadBalancing;
+		size_t fineGrainSize;
+
+		// binding version of kernel after this plan bound its parameters
+		size_t bindingVersion;
+	public:
+		LaunchPlan();
+
+		// same as Computer::compute with the plan's arguments, returns workload ratios of devices
+		std::vector<double> launch();
+
+		// same as Computer::computeAsync with the plan's arguments
+		ComputeHandle launchAsync();
+	};
+}
+#endif // !GPGPU_LAUNCH_PLAN_LIB
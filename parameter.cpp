@@ -1,9 +1,40 @@
 #include "parameter.h"
+#include "host-memory.h"
+#include <atomic>
 
 namespace GPGPU
 {
 	struct Computer;
 
+	// page-locked memory of a discrete device's context (CL_MEM_ALLOC_HOST_PTR), mapped once for the lifetime of the parameter: its copies are DMA transfers without a staging copy in driver
+	// returns nullptr if driver can not allocate it or does not map it to a page-aligned address (caller uses pool instead)
+	static int8_t* allocatePinned(const GPGPU_LIB::Context& context, size_t numBytes, std::shared_ptr<int8_t>& owner)
+	{
+		cl_int op = CL_SUCCESS;
+		cl::Buffer pinned(context.context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE, numBytes, nullptr, &op);
+		if (op != CL_SUCCESS)
+			return nullptr;
+
+		cl::CommandQueue mapQueue(context.context, context.device.device, 0, &op);
+		if (op != CL_SUCCESS)
+			return nullptr;
+
+		void* mapped = mapQueue.enqueueMapBuffer(pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, numBytes, nullptr, nullptr, &op);
+		if (op != CL_SUCCESS || mapped == nullptr)
+			return nullptr;
+
+		if (reinterpret_cast<uintptr_t>(mapped) % GPGPU_LIB::HostMemoryPool::pageSize != 0)
+		{
+			mapQueue.enqueueUnmapMemObject(pinned, mapped);
+			mapQueue.finish();
+			return nullptr;
+		}
+
+		// buffer and queue are reference-counted, they live as long as the last handle of the parameter
+		owner = std::shared_ptr<int8_t>(reinterpret_cast<int8_t*>(mapped), [pinned, mapQueue](int8_t* pt) mutable { if (pt) { mapQueue.enqueueUnmapMemObject(pinned, pt); mapQueue.finish(); } });
+		return reinterpret_cast<int8_t*>(mapped);
+	}
+
 	HostParameter::HostParameter(
 		std::string parameterName,
 		size_t nElements,
@@ -13,9 +44,16 @@ namespace GPGPU
 		bool write,
 		bool readAll,
 		bool writeAll,
-		bool isScalar
+		bool isScalar,
+		bool isResident,
+		size_t halo,
+		const GPGPU_LIB::HostMemoryPolicy* memoryPolicy,
+		std::string mappedFile,
+		bool isOutOfCore,
+		const GPGPU_LIB::Context* pinnedContext
 	) :
 		name(parameterName),
+		id(-1),
 		n(nElements),
 		elementSize(sizeElement),
 		elementsPerThr(elementsPerThread),
@@ -23,13 +61,36 @@ namespace GPGPU
 		writeOp(write),
 		readAllOp(readAll),
 		writeAllOp(writeAll),
-		scalar(isScalar)
+		scalar(isScalar),
+		residentOp(isResident),
+		haloElements(halo),
+		outOfCoreOp(isOutOfCore),
+		appendCounterId(-1),
+		appendCounterOp(false),
+		version(std::make_shared<size_t>(1))
 	{
 		
-		// if a buffer is meant to be read-write in kernel, then it can not be read/written from host side for optimization reasons so use it as read=false write=false that means only device can access it.
-		if (read && write)
+		if (halo > 0 && (!read || readAll))
+		{
+			throw std::invalid_argument("Error: halo is only meaningful for inputs that are copied per device region.");
+		}
+
+		if (isResident && (read || write))
 		{
-			throw std::invalid_argument("Error: Buffer can not be both input and output at the same time. If kernel is meant to read/write this buffer arbitrarily, then use read=false write=false and access it within device freely as a state-management. This may also require an extra kernel to initialize the buffer.");
+			throw std::invalid_argument("Error: resident buffer is not copied in runs, it can not be an input or an output.");
+		}
+
+		// tiles are cut from work-item regions, so only load-balanced inputs/outputs can be out-of-core
+		if (isOutOfCore && (!(read || write) || readAll || writeAll || isResident || halo > 0))
+		{
+			throw std::invalid_argument("Error: only load-balanced inputs and outputs (without halo) can be out-of-core.");
+		}
+
+		// a read-write buffer is updated in place: each device uploads its own region, kernel changes it and device downloads same region (devices have disjoint regions so there is no race)
+		// whole-array copies would make devices overwrite each other's results, so those can not be both input and output
+		if (read && write && (readAll || writeAll))
+		{
+			throw std::invalid_argument("Error: Buffer can not be both input and output with all elements. If kernel is meant to read/write this buffer arbitrarily, then use read=false write=false and access it within device freely as a state-management. This may also require an extra kernel to initialize the buffer.");
 		}
 
 		if (parameterName == "")
@@ -38,18 +99,33 @@ namespace GPGPU
 		}
 		else
 		{
-			// allocate buffer with enough padding for alignment and size restrictions of mapping/unmapping of OpenCL buffer
-			quickPtrVal = new int8_t[nElements * sizeElement + 4096 /* for re-alignment*/ + 4096 /* for zero-copy mapping CL_USE_HOST_PTR */];
-
-			// align buffer
-			size_t val = (size_t)quickPtrVal;
-			while ((val % 4096) != 0)
+			// page-aligned block from pool with enough padding for size restrictions of mapping/unmapping of OpenCL buffer (zero-copy CL_USE_HOST_PTR)
+			std::shared_ptr<GPGPU_LIB::HostMemoryPool> pool = GPGPU_LIB::HostMemoryPool::instance();
+			size_t blockBytes = 0;
+			if (mappedFile != "")
 			{
-				val++;
+				// file is the array (outputs write back to it), same page alignment and padding as pooled blocks
+				const size_t fileBytes = nElements * sizeElement;
+				quickPtrVal = pool->mapFile(mappedFile, fileBytes, fileBytes + 4096, write, blockBytes);
+				ptr = std::shared_ptr<int8_t>(quickPtrVal, [pool, blockBytes, mappedFile, fileBytes, write](int8_t* pt) { if (pt) pool->unmapFile(pt, blockBytes, mappedFile, fileBytes, write); });
 			}
-
-			ptr = std::shared_ptr<int8_t>(quickPtrVal, [](int8_t* pt) { if (pt) delete[] pt; }); // last host parameter standing releases memory
-			quickPtr = reinterpret_cast<int8_t*>(val);
+			else if (memoryPolicy == nullptr || memoryPolicy->isDefault())
+			{
+				quickPtrVal = (pinnedContext != nullptr) ? allocatePinned(*pinnedContext, nElements * sizeElement + 4096, ptr) : nullptr;
+				if (quickPtrVal == nullptr)
+				{
+					quickPtrVal = pool->allocate(nElements * sizeElement + 4096, blockBytes);
+					ptr = std::shared_ptr<int8_t>(quickPtrVal, [pool, blockBytes](int8_t* pt) { if (pt) pool->release(pt, blockBytes); }); // last host parameter standing returns memory to pool
+				}
+			}
+			else
+			{
+				// huge pages / NUMA placement: separately mapped block
+				GPGPU_LIB::HostMemoryPolicy policy = *memoryPolicy;
+				quickPtrVal = pool->allocate(nElements * sizeElement + 4096, policy, blockBytes);
+				ptr = std::shared_ptr<int8_t>(quickPtrVal, [pool, blockBytes, policy](int8_t* pt) { if (pt) pool->release(pt, blockBytes, policy); });
+			}
+			quickPtr = quickPtrVal;
 		}
 		prmList.push_back(parameterName);
 	}
@@ -58,6 +134,19 @@ namespace GPGPU
 	{
 		HostParameter result = *this;
 		result.prmList.push_back(prm.name);
+
+		// counter of an append buffer is bound right after it
+		if (prm.isAppend())
+			result.prmList.push_back(prm.appendCounterName());
+		return result;
+	}
+
+	HostParameter HostParameter::duplicate(std::string parameterName) const
+	{
+		HostParameter result(parameterName, n, elementSize, elementsPerThr, readOp, writeOp, readAllOp, writeAllOp, scalar, residentOp, haloElements, nullptr, "", outOfCoreOp);
+		result.reductionIdentity = reductionIdentity;
+		result.reductionCombiner = reductionCombiner;
+		std::copy(quickPtr, quickPtr + (n * elementSize), result.quickPtr);
 		return result;
 	}
 
@@ -73,6 +162,7 @@ namespace GPGPU_LIB
 
 		Parameter::Parameter(Context con, GPGPU::HostParameter hostParameter ) :
 			name(hostParameter.name),
+			id(hostParameter.id),
 			n(hostParameter.n),
 			elementSize(hostParameter.elementSize),
 			hostPrm(hostParameter),
@@ -81,17 +171,50 @@ namespace GPGPU_LIB
 			readAll(hostParameter.readAllOp),
 			writeAll(hostParameter.writeAllOp),
 			scalar(hostParameter.isScalar()),
-			elementsPerThread(hostParameter.elementsPerThr)
+			residentOp(hostParameter.isResident()),
+			haloElements(hostParameter.haloElements),
+			elementsPerThread(hostParameter.elementsPerThr),
+			resident(std::make_shared<ResidentData>(ResidentData{ 0, 0, 0, {}, {} }))
 		{
-			bool sharesRAM = con.device.sharesRAM;
+			// reductions, append buffers and their counters need a private copy per device, so they never use host memory directly
+			bool sharesRAM = con.device.sharesRAM && !hostParameter.isReduction() && !hostParameter.isAppend() && !hostParameter.isAppendCounter();
+			if (hostParameter.isAppend())
+			{
+				append = std::make_shared<AppendData>();
+				append->counterId = hostParameter.appendCounterId;
+				append->count = 0;
+				append->requested = 0;
+				append->ready = false;
+			}
+			if (hostParameter.isReduction())
+			{
+				reduction = std::make_shared<ReductionData>();
+				reduction->identity.resize(n * elementSize);
+				reduction->partial.resize(n * elementSize);
+				reduction->ready = false;
+				for (size_t i = 0; i < n; i++)
+				{
+					std::copy(hostParameter.reductionIdentity->begin(), hostParameter.reductionIdentity->end(), reduction->identity.begin() + i * elementSize);
+				}
+			}
 
 
 
+			if (hostParameter.isOutOfCore())
+			{
+				// only tiles are on device
+				tiles = std::make_shared<TileData>();
+				for (int i = 0; i < TileData::numSlots; i++)
+					tiles->slotBytes[i] = 0;
+				return;
+			}
+
 			buffer = ((hostParameter.name == "") ? cl::Buffer() : cl::Buffer(con.context,
 
 				(sharesRAM ? CL_MEM_USE_HOST_PTR : 0) |
 				(
-					 
+					(hostParameter.readOp && hostParameter.writeOp) ?
+						CL_MEM_READ_WRITE : // in-place: host writes and reads own region of device, kernel reads and writes it
 					hostParameter.readOp ? 
 						(CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY) : // host only writes, kernel only reads
 						(hostParameter.writeOp?
@@ -108,4 +231,38 @@ namespace GPGPU_LIB
 
 			));
 		}
-}
\ No newline at end of file
+
+		bool Parameter::requiresUpload(size_t begin, size_t end)
+		{
+			const size_t hostVersion = hostPrm.getVersion();
+			if (resident->version == hostVersion)
+			{
+				if (begin >= resident->begin && end <= resident->end)
+					return false;
+
+				// consecutive chunks of same version extend the range
+				if (begin <= resident->end && end >= resident->begin)
+				{
+					resident->begin = std::min(begin, resident->begin);
+					resident->end = std::max(end, resident->end);
+					return true;
+				}
+			}
+			resident->version = hostVersion;
+			resident->begin = begin;
+			resident->end = end;
+			resident->uploads.clear();
+			return true;
+		}
+
+		void Parameter::recordWrite(size_t begin, size_t end)
+		{
+			// all devices share the clock, runs are sequential so a later run always has bigger stamps
+			static std::atomic<size_t> writeClock(0);
+			std::vector<DeviceWrite>& writes = resident->writes;
+
+			// own older writes that are covered are not needed anymore (keeps the list short for repeated runs over same range)
+			writes.erase(std::remove_if(writes.begin(), writes.end(), [begin, end](const DeviceWrite& w) { return w.begin >= begin && w.end <= end; }), writes.end());
+			writes.push_back(DeviceWrite{ writeClock.fetch_add(1), begin, end });
+		}
+}
@@ -8,11 +8,15 @@
 
 #include <memory>
 #include <algorithm>
+#include <map>
+#include <functional>
 // forward-declaring for friendship because only friends have access to private parts
 namespace GPGPU_LIB
 {
 	struct Parameter;
 	struct CommandQueue;
+	struct HostMemoryPolicy;
+	struct Context;
 }
 
 namespace GPGPU
@@ -29,6 +33,9 @@ namespace GPGPU
 		friend struct Computer;
 	private:
 		std::string name;
+
+		// dense index given by Computer (-1 = not created by a Computer), used by workers instead of name
+		int id;
 		size_t n;
 		size_t elementSize;
 		size_t elementsPerThr;
@@ -43,6 +50,31 @@ namespace GPGPU
 		bool readAllOp;
 		bool writeAllOp;
 		bool scalar;
+
+		// stays on devices between runs, copied only by Computer::syncToHost / Computer::syncToDevices
+		bool residentOp;
+
+		// number of neighboring elements on each side of a device's region that are uploaded with the region (load-balanced inputs of stencil kernels)
+		size_t haloElements;
+
+		// out-of-core: devices do not allocate whole array, Computer::computeOutOfCore streams tiles of it through small device buffers
+		bool outOfCoreOp;
+
+		// reduction: identity value of one element (null if not a reduction) and combiner of per-device partials (accumulator[i] = combine(accumulator[i], partial[i]) for numElements elements)
+		// each device gets a private copy initialized to identity, host gets combination of all devices after run
+		std::shared_ptr<std::vector<int8_t>> reductionIdentity;
+		std::function<void(int8_t* accumulator, const int8_t* partial, size_t numElements)> reductionCombiner;
+
+		// append buffer: kernels append elements through a counter (next kernel argument, "name#count") into device's private buffer
+		// host gets used prefixes of all devices compacted in device order
+		// id of counter parameter, -1 = not an append buffer
+		int appendCounterId;
+
+		// counter of an append buffer: each device counts in its own private word
+		bool appendCounterOp;
+
+		// incremented by every host-side write access (shared by copies of this parameter, like the data), devices skip uploads of versions they already have
+		std::shared_ptr<size_t> version;
 	public:
 		HostParameter(
 			std::string parameterName = "",
@@ -53,26 +85,50 @@ namespace GPGPU
 			bool write = false,
 			bool readAll = false,
 			bool writeAll = false,
-			bool isScalar = false
+			bool isScalar = false,
+			bool isResident = false,
+			size_t halo = 0,
+			const GPGPU_LIB::HostMemoryPolicy* memoryPolicy = nullptr,
+			std::string mappedFile = "",
+			bool isOutOfCore = false,
+			const GPGPU_LIB::Context* pinnedContext = nullptr
 		);
 
 		const bool isScalar() const { return scalar; }
+		const bool isResident() const { return residentOp; }
+		const bool isReduction() const { return reductionIdentity != nullptr; }
+		const bool isAppend() const { return appendCounterId >= 0; }
+		const bool isAppendCounter() const { return appendCounterOp; }
+		const bool isOutOfCore() const { return outOfCoreOp; }
+
+		// name of counter parameter of an append buffer
+		std::string appendCounterName() const { return name + "#count"; }
 
 		// operator overloading from char buffer
+		// marks data as changed (next run uploads it again)
 		template<typename T>
 		T& access(size_t index)
 		{
+			++*version;
 			return *reinterpret_cast<T*>(quickPtr + (index * elementSize));
 		}
 
+		// marks data as changed. writes through a pointer that was taken before a run are not detected, call accessPtr again after such writes
 		template<typename T>
 		T* accessPtr(size_t index)
 		{
+			++*version;
 			return reinterpret_cast<T*>(quickPtr + (index * elementSize));
 		}
 
+		// current version of host data
+		size_t getVersion() const { return *version; }
+
 		HostParameter next(HostParameter prm);
 
+		// new parameter with same properties and its own copy of data
+		HostParameter duplicate(std::string parameterName) const;
+
 		// read buffer and write to region starting at ptrPrm
 		// numElements=0 means all elements are copied
 		template<typename T>
@@ -93,6 +149,7 @@ namespace GPGPU
 		{
 			elementOffset = (numElements == 0 ? 0 : elementOffset);
 			numElements = (numElements == 0 ? n : numElements);
+			++*version;
 			std::copy(
 				ptrPrm,
 				ptrPrm+numElements,
@@ -102,6 +159,8 @@ namespace GPGPU
 
 		std::string getName();		
 
+		int getId() const { return id; }
+
 		// number of bytes per element
 		const size_t getElementSize() const
 		{
@@ -112,6 +171,7 @@ namespace GPGPU
 		template<typename T>
 		void operator = (const T& newValue)
 		{
+			++*version;
 			std::fill(
 				reinterpret_cast<T*>(quickPtr),
 				reinterpret_cast<T*>(quickPtr + (n * elementSize)),
@@ -124,6 +184,7 @@ namespace GPGPU
 			elementSize = hPrm.elementSize;
 
 			name=hPrm.name;
+			id=hPrm.id;
 			n=hPrm.n;
 			elementSize=hPrm.elementSize;
 			elementsPerThr=hPrm.elementsPerThr;
@@ -138,6 +199,14 @@ namespace GPGPU
 			readAllOp=hPrm.readAllOp;
 			writeAllOp = hPrm.writeAllOp;
 			scalar = hPrm.scalar;
+			residentOp = hPrm.residentOp;
+			haloElements = hPrm.haloElements;
+			outOfCoreOp = hPrm.outOfCoreOp;
+			reductionIdentity = hPrm.reductionIdentity;
+			reductionCombiner = hPrm.reductionCombiner;
+			appendCounterId = hPrm.appendCounterId;
+			appendCounterOp = hPrm.appendCounterOp;
+			version = hPrm.version;
 		}
 
 	};
@@ -148,10 +217,61 @@ namespace GPGPU_LIB
 
 
 
+	// byte range [begin, end) of a resident parameter written by kernels of a device, stamp orders writes of all devices
+	struct DeviceWrite
+	{
+		size_t stamp;
+		size_t begin;
+		size_t end;
+	};
+
+	// host data version and byte range [begin, end) that a device buffer holds (shared by copies of a Parameter in kernels of same device)
+	// uploads: last upload of that range enqueued on each command queue of the device (a queue that skips the upload waits for those of other queues)
+	// writes: ranges of a resident parameter computed by this device since last host synchronization
+	struct ResidentData
+	{
+		size_t version;
+		size_t begin;
+		size_t end;
+		std::map<const CommandQueue*, cl::Event> uploads;
+		std::vector<DeviceWrite> writes;
+	};
+
+	// private copy of a reduction parameter on a device: identity values to reset it before a run, partial results downloaded after the run
+	// ready = partial is downloaded but not combined on host yet
+	struct ReductionData
+	{
+		std::vector<int8_t> identity;
+		std::vector<int8_t> partial;
+		bool ready;
+	};
+
+	// private buffer of an append parameter on a device: id of its counter parameter, number of appended elements and their copy on host after a run
+	// requested: value of counter (appends that were tried, more than count if buffer overflowed)
+	// ready = staging is downloaded but not copied to host array yet
+	struct AppendData
+	{
+		int counterId;
+		size_t count;
+		size_t requested;
+		std::vector<int8_t> staging;
+		bool ready;
+	};
+
+	// device buffers of an out-of-core parameter: each tile in flight has its own slot (buffer) so that upload, kernel and download of consecutive tiles overlap
+	// slots are allocated on first use and grown when a bigger tile is used
+	struct TileData
+	{
+		const static int numSlots = 3;
+		cl::Buffer slots[numSlots];
+		size_t slotBytes[numSlots];
+	};
+
 	// per-device allocated memory
 	struct Parameter
 	{
 		std::string name;
+		int id;
 		size_t n;
 		size_t elementSize;
 		size_t elementsPerThread;
@@ -162,8 +282,27 @@ namespace GPGPU_LIB
 		bool readAll;
 		bool writeAll;	
 		bool scalar;
+		bool residentOp;
+		size_t haloElements;
+		std::shared_ptr<ResidentData> resident;
+
+		// null if not a reduction
+		std::shared_ptr<ReductionData> reduction;
+
+		// null if not an append buffer
+		std::shared_ptr<AppendData> append;
+
+		// null if not out-of-core (buffer is not allocated for those)
+		std::shared_ptr<TileData> tiles;
 		Parameter(Context con = Context(), GPGPU::HostParameter hostParameter = GPGPU::HostParameter());
 		const bool isScalar() const { return scalar;  }
+
+		// returns false if bytes [begin, end) of current host version are already on device
+		// otherwise returns true and records them as uploaded (caller enqueues the upload)
+		bool requiresUpload(size_t begin, size_t end);
+
+		// records bytes [begin, end) of a resident parameter as computed by this device (newer than all previously recorded writes of all devices)
+		void recordWrite(size_t begin, size_t end);
 	};
 
 
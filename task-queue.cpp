@@ -7,9 +7,13 @@ namespace GPGPU_LIB
 
 
 	GPGPUTask::GPGPUTask() :
-			kernelCode(""),
-			kernelName(""),
-			parameterName(""),
+			kernelCode(nullptr),
+			kernelFunction(nullptr),
+			kernelId(-1),
+			cloneId(-1),
+			kernelIds(nullptr),
+			numKernels(0),
+			parameterId(-1),
 			parameterPosition(0),
 			offset(0),
 			globalSize(0),
@@ -19,42 +23,241 @@ namespace GPGPU_LIB
 			taskType(0),
 			conPtr(nullptr),
 			mutexPtr(nullptr),
+			streamBatchPtr(nullptr),
 			sharedTaskQueue(nullptr),
+			stealingQueue(nullptr),
+			guidedQueue(nullptr),
+			workerIndex(0),
+			overlapChunks(1),
+			chunksInFlight(1),
+			outOfCore(false),
 			globalOffset(0)
 		{}
 
 
-		GPGPUTaskQueue::GPGPUTaskQueue()
-		{
+		// number of failed attempts before sleeping (dispatch/retire of small kernels usually completes within this)
+		static const int spinCount = 256;
 
+		GPGPUTaskQueue::GPGPUTaskQueue(size_t capacity) :pushPosition(0), popPosition(0), sleepingConsumers(0), sleepingProducers(0)
+		{
+			size_t size = 2;
+			while (size < capacity)
+			{
+				size *= 2;
+			}
+			mask = size - 1;
+			cells = std::unique_ptr<Cell[]>(new Cell[size]);
+			for (size_t i = 0; i < size; i++)
+			{
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
 		}
 
 		bool GPGPUTaskQueue::inProgress()
 		{
-			std::lock_guard<std::mutex> lock(syncPoint);
-			return tasks.size() > 0;
+			return popPosition.load() != pushPosition.load();
+		}
+
+		bool GPGPUTaskQueue::tryPush(GPGPUTask& task)
+		{
+			size_t position = pushPosition.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Cell& cell = cells[position & mask];
+				const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+				if (difference == 0)
+				{
+					if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						cell.task = task;
+						cell.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0)
+				{
+					return false;
+				}
+				else
+				{
+					position = pushPosition.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool GPGPUTaskQueue::tryPop(GPGPUTask& task)
+		{
+			size_t position = popPosition.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Cell& cell = cells[position & mask];
+				const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+				if (difference == 0)
+				{
+					if (popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						task = cell.task;
+						cell.sequence.store(position + mask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0)
+				{
+					return false;
+				}
+				else
+				{
+					position = popPosition.load(std::memory_order_relaxed);
+				}
+			}
 		}
 
 		void GPGPUTaskQueue::push(GPGPUTask task)
 		{
-			std::lock_guard<std::mutex> lock(syncPoint);
-			tasks.push(task);
-			condition.notify_all();
+			for (int i = 0; !tryPush(task); i++)
+			{
+				if (i < spinCount)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(syncPoint);
+				sleepingProducers++;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				while (!tryPush(task))
+				{
+					condition.wait(lock);
+				}
+				sleepingProducers--;
+				break;
+			}
+
+			// a consumer that went to sleep before this push needs a signal
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (sleepingConsumers.load() > 0)
+			{
+				std::lock_guard<std::mutex> lock(syncPoint);
+				condition.notify_all();
+			}
 		}
 
 		GPGPUTask GPGPUTaskQueue::pop()
 		{
+			GPGPUTask result;
+			for (int i = 0; !tryPop(result); i++)
+			{
+				if (i < spinCount)
+				{
+					std::this_thread::yield();
+					continue;
+				}
 
-			std::unique_lock<std::mutex> lock(syncPoint);
+				std::unique_lock<std::mutex> lock(syncPoint);
+				sleepingConsumers++;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				while (!tryPop(result))
+				{
+					condition.wait(lock);
+				}
+				sleepingConsumers--;
+				break;
+			}
 
-			while (tasks.size() == 0)
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (sleepingProducers.load() > 0)
 			{
-				condition.wait(lock, [&]() { return tasks.size() > 0;  });
+				std::lock_guard<std::mutex> lock(syncPoint);
+				condition.notify_all();
 			}
-
-			GPGPUTask result = tasks.front();
-			tasks.pop();
 			return result;
 		}
 
+		GPGPUWorkStealingQueue::GPGPUWorkStealingQueue(int numWorkers)
+		{
+			for (int i = 0; i < numWorkers; i++)
+			{
+				deques.push_back(std::make_unique<Deque>());
+			}
+		}
+
+		void GPGPUWorkStealingQueue::push(int workerIndex, GPGPUTask task)
+		{
+			std::lock_guard<std::mutex> lock(deques[workerIndex]->syncPoint);
+			deques[workerIndex]->tasks.push_back(task);
+		}
+
+		GPGPUTask GPGPUWorkStealingQueue::pop(int workerIndex)
+		{
+			const int n = deques.size();
+
+			// own chunks first, in order
+			{
+				Deque& own = *deques[workerIndex];
+				std::lock_guard<std::mutex> lock(own.syncPoint);
+				if (own.tasks.size() > 0)
+				{
+					GPGPUTask result = own.tasks.front();
+					own.tasks.pop_front();
+					return result;
+				}
+			}
+
+			// steal from far end of neighbors
+			for (int i = 1; i < n; i++)
+			{
+				Deque& victim = *deques[(workerIndex + i) % n];
+				std::lock_guard<std::mutex> lock(victim.syncPoint);
+				if (victim.tasks.size() > 0)
+				{
+					GPGPUTask result = victim.tasks.back();
+					victim.tasks.pop_back();
+					return result;
+				}
+			}
+
+			return GPGPUTask();
+		}
+
+		GPGPUGuidedTaskQueue::GPGPUGuidedTaskQueue(int kernelIdPrm, size_t globalOffsetPrm, size_t numGlobalThreadsPrm, size_t numLocalThreadsPrm, size_t minChunkSizePrm, std::vector<double> throughputShares) :
+			nextOffset(0),
+			kernelId(kernelIdPrm),
+			globalOffset(globalOffsetPrm),
+			numGlobalThreads(numGlobalThreadsPrm),
+			numLocalThreads(numLocalThreadsPrm),
+			minChunkSize(std::max(minChunkSizePrm, numLocalThreadsPrm)),
+			shares(throughputShares)
+		{
+
+		}
+
+		GPGPUTask GPGPUGuidedTaskQueue::pop(int workerIndex)
+		{
+			size_t current = nextOffset.load();
+			while (current < numGlobalThreads)
+			{
+				const size_t remaining = numGlobalThreads - current;
+
+				// half of the worker's fair share of remaining work so that estimation errors can still be corrected by later chunks
+				size_t chunk = (size_t)(remaining * shares[workerIndex] * 0.5);
+				chunk = (chunk / numLocalThreads) * numLocalThreads;
+				chunk = std::min(std::max(chunk, minChunkSize), remaining);
+
+				if (nextOffset.compare_exchange_weak(current, current + chunk))
+				{
+					GPGPUTask task;
+					task.taskType = GPGPUTask::GPGPU_TASK_COMPUTE;
+					task.kernelId = kernelId;
+					task.globalOffset = globalOffset;
+					task.offset = current;
+					task.globalSize = chunk;
+					task.localSize = numLocalThreads;
+					return task;
+				}
+			}
+			return GPGPUTask();
+		}
+
 }
\ No newline at end of file
@@ -10,9 +10,29 @@
 #include "parameter.h"
 #include "command-queue.h"
 #include "context.h"
+#include <deque>
+#include <atomic>
+#include <type_traits>
 namespace GPGPU_LIB
 {
 	struct GPGPUTaskQueue;
+	struct GPGPUWorkStealingQueue;
+
+	// commands of one batch of a stream on one device
+	struct GPGPUStreamBatch
+	{
+		std::vector<cl::Event> uploadEvents;
+		std::vector<cl::Event> kernelEvents;
+		std::vector<cl::Event> downloadEvents;
+
+		// completes when outputs of batch are downloaded
+		cl::Event completion;
+	};
+
+	struct GPGPUGuidedTaskQueue;
+
+	// trivially copyable description of a job of a worker
+	// kernels and parameters are referred by dense integer ids given by Computer. pointed objects are owned by the caller and outlive the task
 	struct GPGPUTask
 	{
 		const static int GPGPU_TASK_NULL = 0;
@@ -24,10 +44,25 @@ namespace GPGPU_LIB
 		const static int GPGPU_TASK_RETURN_NANO_BENCH = 6;
 		const static int GPGPU_TASK_COMPUTE_ALL = 7;
 		const static int GPGPU_TASK_COMPUTE_MULTIPLE = 8;
-		std::string kernelCode;
-		std::string kernelName;
-		std::vector<std::string> kernelNames;
-		std::string parameterName;
+		const static int GPGPU_TASK_CLONE_KERNEL = 9;
+		const static int GPGPU_TASK_STREAM = 10;
+		const static int GPGPU_TASK_RESIDENT_TO_HOST = 11;
+		const static int GPGPU_TASK_RESIDENT_TO_DEVICE = 12;
+		const static int GPGPU_TASK_RESIDENT_RANGE_TO_DEVICE = 13;
+		// compile: source code and name of kernel function
+		const std::string* kernelCode;
+		const std::string* kernelFunction;
+
+		// kernel to compile/run/bind (source kernel of clone), load-balancing key of a multiple-kernel run
+		int kernelId;
+
+		// clone: id of new kernel
+		int cloneId;
+
+		// kernels of a multiple-kernel run
+		const int* kernelIds;
+		int numKernels;
+		int parameterId;
 		int parameterPosition;
 		size_t offset;
 		size_t globalSize;
@@ -35,9 +70,22 @@ namespace GPGPU_LIB
 		size_t globalOffset;
 		GPGPU::HostParameter* hostParPtr;
 		CommandQueue* comQuePtr;
-		std::shared_ptr<GPGPUTaskQueue> sharedTaskQueue;
+		GPGPUTaskQueue* sharedTaskQueue;
+		GPGPUWorkStealingQueue* stealingQueue;
+		GPGPUGuidedTaskQueue* guidedQueue;
+		int workerIndex;
+
+		// number of sub-chunks of a compute task whose copies overlap kernels of neighboring sub-chunks (1 = no overlap)
+		int overlapChunks;
+
+		// maximum number of chunks of a fine-grained task that are enqueued on device without being waited
+		int chunksInFlight;
+
+		// chunks of a fine-grained task are tiles of out-of-core parameters (computed through tile slots with overlapped copies)
+		bool outOfCore;
 		Context* conPtr;
 		std::mutex* mutexPtr;
+		GPGPUStreamBatch* streamBatchPtr;
 
 		// no task = 0
 		// compile a kernel = 1
@@ -46,26 +94,95 @@ namespace GPGPU_LIB
 		// compute a kernel (copy input + run kernel + copy output) = 4
 		// stop working = 5
 		// benchmark execution = 6 (for load-balancing)
+		// compute chunks from a shared queue = 7
+		// compute multiple kernels = 8
+		// clone a kernel (kernelId) into a new kernel (cloneId) = 9
+		// enqueue upload, kernel, download of a stream batch on separate queues without waiting = 10
+		// download bytes [offset, offset + globalSize) of a resident parameter (parameterId) = 11
+		// upload all bytes of a resident parameter and forget its recorded writes = 12
+		// upload bytes [offset, offset + globalSize) of a resident parameter from host, keeping recorded writes = 13
 		int taskType;
 
 
 		GPGPUTask();
 
 	};
+	static_assert(std::is_trivially_copyable<GPGPUTask>::value, "GPGPUTask is copied through ring buffers and must stay trivially copyable");
 
+	/*
+		bounded lock-free multi-producer multi-consumer ring buffer (each cell has a sequence number that tells whether it is ready for next push or next pop)
+		push() and pop() spin shortly when queue is full/empty, then sleep on a condition variable until the other side signals
+		the mutex is only used for sleeping, not for data
+	*/
 	struct GPGPUTaskQueue
 	{
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			GPGPUTask task;
+		};
+		std::unique_ptr<Cell[]> cells;
+		size_t mask;
+		alignas(64) std::atomic<size_t> pushPosition;
+		alignas(64) std::atomic<size_t> popPosition;
+
+		// number of threads sleeping in pop() (queue empty) and push() (queue full)
+		alignas(64) std::atomic<int> sleepingConsumers;
+		std::atomic<int> sleepingProducers;
 		std::mutex syncPoint;
 		std::condition_variable condition;
-		std::queue<GPGPUTask> tasks;
 
-		GPGPUTaskQueue();
+		// capacity is rounded up to a power of 2
+		GPGPUTaskQueue(size_t capacity = 256);
 
 		bool inProgress();
 
 		void push(GPGPUTask task);
 
 		GPGPUTask pop();
+
+		// returns false without waiting if queue is full/empty
+		bool tryPush(GPGPUTask& task);
+		bool tryPop(GPGPUTask& task);
+	};
+
+	// one deque of chunks per worker for fine-grained load-balancing
+	// a worker takes chunks from front of its own deque (neighboring chunks stay on same device) and steals from back of others' deques when its own deque is empty
+	// all chunks are pushed before workers start consuming
+	struct GPGPUWorkStealingQueue
+	{
+		struct Deque
+		{
+			std::mutex syncPoint;
+			std::deque<GPGPUTask> tasks;
+		};
+		std::vector<std::unique_ptr<Deque>> deques;
+
+		GPGPUWorkStealingQueue(int numWorkers);
+
+		void push(int workerIndex, GPGPUTask task);
+
+		// returns a task with GPGPU_TASK_NULL type when all deques are empty
+		GPGPUTask pop(int workerIndex);
+	};
+
+	// hands out chunks of decreasing size for fine-grained load-balancing (guided scheduling)
+	// a chunk is a part of remaining work proportional to throughput share of the requesting worker, rounded to work-group size and not smaller than minimum chunk size
+	// early chunks are large (low per-chunk overhead), last chunks are small (devices finish together)
+	struct GPGPUGuidedTaskQueue
+	{
+		std::atomic<size_t> nextOffset;
+		int kernelId;
+		size_t globalOffset;
+		size_t numGlobalThreads;
+		size_t numLocalThreads;
+		size_t minChunkSize;
+		std::vector<double> shares;
+
+		GPGPUGuidedTaskQueue(int kernelIdPrm, size_t globalOffsetPrm, size_t numGlobalThreadsPrm, size_t numLocalThreadsPrm, size_t minChunkSizePrm, std::vector<double> throughputShares);
+
+		// returns a task with GPGPU_TASK_NULL type when all work is handed out
+		GPGPUTask pop(int workerIndex);
 	};
 
 }
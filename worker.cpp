@@ -8,6 +8,8 @@ namespace GPGPU_LIB
 
 		context = Context(dev);
 		queue = CommandQueue(context);
+		uploadQueue = CommandQueue(context);
+		downloadQueue = CommandQueue(context);
 
 
 		if (dev.id >= 0)
@@ -33,6 +35,9 @@ namespace GPGPU_LIB
 		bool isWorking = true;
 		size_t nanoLastCommand = 0;
 		size_t workLastCommand = 0;
+		double nanoUpload = 0;
+		double nanoKernel = 0;
+		double nanoDownload = 0;
 		while (isWorking)
 		{
 
@@ -44,14 +49,19 @@ namespace GPGPU_LIB
 			case (GPGPUTask::GPGPU_TASK_COMPILE):
 			{
 				std::lock_guard<std::mutex> lg(*task.mutexPtr);
-				mapKernelNameToKernel[task.kernelName] = Kernel(*task.conPtr, task.kernelCode, task.kernelName);
+				if (kernels.size() <= task.kernelId)
+					kernels.resize(task.kernelId + 1);
+				kernels[task.kernelId] = Kernel(*task.conPtr, *task.kernelCode, *task.kernelFunction);
 				break;
 			}
 
 			case (GPGPUTask::GPGPU_TASK_MIRROR):
 			{
 
-				mapParameterNameToParameter[task.hostParPtr->getName()] = Parameter(*task.conPtr, *task.hostParPtr);
+				const int id = task.hostParPtr->getId();
+				if (parameters.size() <= id)
+					parameters.resize(id + 1);
+				parameters[id] = Parameter(*task.conPtr, *task.hostParPtr);
 				break;
 			}
 
@@ -66,16 +76,30 @@ namespace GPGPU_LIB
 			case (GPGPUTask::GPGPU_TASK_COMPUTE):
 			{
 				workLastCommand = 0;
+				nanoUpload = 0;
+				nanoKernel = 0;
+				nanoDownload = 0;
 				{
 					GPGPU::Bench bench(&nanoLastCommand);
-					Kernel& kernel = mapKernelNameToKernel[task.kernelName];
-					task.comQuePtr->copyInputsOfKernel(kernel, task.globalOffset, task.offset, task.globalSize);
-					task.comQuePtr->run(kernel, task.globalOffset, task.globalSize, task.localSize, task.offset);
-					task.comQuePtr->copyOutputsOfKernel(kernel, task.globalOffset, task.offset, task.globalSize);
+					Kernel& kernel = kernels[task.kernelId];
+					task.comQuePtr->resetDeviceResults(kernel);
+					if (task.overlapChunks > 1)
+					{
+						computeOverlapped(kernel, task);
+					}
+					else
+					{
+						task.comQuePtr->copyInputsOfKernel(kernel, task.globalOffset, task.offset, task.globalSize);
+						task.comQuePtr->run(kernel, task.globalOffset, task.globalSize, task.localSize, task.offset);
+						task.comQuePtr->copyOutputsOfKernel(kernel, task.globalOffset, task.offset, task.globalSize);
+						task.comQuePtr->sync();
+					}
+					task.comQuePtr->downloadDeviceResults(kernel);
 					workLastCommand += task.globalSize;
-
-					task.comQuePtr->sync();
 				}
+				task.comQuePtr->collectTimings(nanoUpload, nanoKernel, nanoDownload);
+				uploadQueue.collectTimings(nanoUpload, nanoKernel, nanoDownload);
+				downloadQueue.collectTimings(nanoUpload, nanoKernel, nanoDownload);
 
 				break;
 			}
@@ -84,19 +108,34 @@ namespace GPGPU_LIB
 			case (GPGPUTask::GPGPU_TASK_COMPUTE_MULTIPLE):
 			{
 				workLastCommand = 0;
+				nanoUpload = 0;
+				nanoKernel = 0;
+				nanoDownload = 0;
 				{
 					GPGPU::Bench bench(&nanoLastCommand);
-					const int nK = task.kernelNames.size();
-					for (int i = 0; i < nK; i++)
+
+					// kernels of the group accumulate into same private copies (reductions, append buffers)
+					for (int i = 0; i < task.numKernels; i++)
+					{
+						task.comQuePtr->resetDeviceResults(kernels[task.kernelIds[i]]);
+					}
+
+					for (int i = 0; i < task.numKernels; i++)
 					{
-						Kernel& kernel = mapKernelNameToKernel[task.kernelNames[i]];
+						Kernel& kernel = kernels[task.kernelIds[i]];
 						task.comQuePtr->copyInputsOfKernel(kernel, task.globalOffset, task.offset, task.globalSize);
 						task.comQuePtr->run(kernel, task.globalOffset, task.globalSize, task.localSize, task.offset);
 						task.comQuePtr->copyOutputsOfKernel(kernel, task.globalOffset, task.offset, task.globalSize);
 						workLastCommand += task.globalSize;
 					}
 					task.comQuePtr->sync();
+
+					for (int i = 0; i < task.numKernels; i++)
+					{
+						task.comQuePtr->downloadDeviceResults(kernels[task.kernelIds[i]]);
+					}
 				}
+				task.comQuePtr->collectTimings(nanoUpload, nanoKernel, nanoDownload);
 
 				break;
 			}
@@ -104,30 +143,130 @@ namespace GPGPU_LIB
 			case (GPGPUTask::GPGPU_TASK_COMPUTE_ALL):
 			{
 				workLastCommand = 0;
+				nanoUpload = 0;
+				nanoKernel = 0;
+				nanoDownload = 0;
 				{
 					GPGPU::Bench bench(&nanoLastCommand);
 					GPGPUTask taskNew;
-					while ((taskNew = task.sharedTaskQueue->pop()).taskType != GPGPUTask::GPGPU_TASK_NULL)
+					auto nextTask = [&]() {
+						if (task.guidedQueue)
+							return task.guidedQueue->pop(task.workerIndex);
+						return task.stealingQueue ? task.stealingQueue->pop(task.workerIndex) : task.sharedTaskQueue->pop();
+					};
+
+					// chunks of a device accumulate into its private copies of reductions and append buffers
+					task.comQuePtr->resetDeviceResults(kernels[task.kernelId]);
+
+					// completion events of enqueued chunks. device keeps working on next chunks while host waits for oldest one
+					// tiles are limited by number of tile slots
+					std::deque<cl::Event> enqueuedChunks;
+					const size_t maxChunksInFlight = task.outOfCore ? (size_t)TileData::numSlots : (size_t)std::max(1, task.chunksInFlight);
+					size_t numTiles = 0;
+					while (true)
 					{
-						Kernel& kernel = mapKernelNameToKernel[taskNew.kernelName];
+						if (enqueuedChunks.size() >= maxChunksInFlight)
+						{
+							enqueuedChunks.front().wait();
+							enqueuedChunks.pop_front();
+						}
+
+						if ((taskNew = nextTask()).taskType == GPGPUTask::GPGPU_TASK_NULL)
+							break;
+
+						Kernel& kernel = kernels[taskNew.kernelId];
+						if (task.outOfCore)
+						{
+							enqueuedChunks.push_back(computeTile(kernel, taskNew, numTiles++));
+							workLastCommand += taskNew.globalSize;
+							continue;
+						}
+
 						task.comQuePtr->copyInputsOfKernel(kernel, taskNew.globalOffset, taskNew.offset, taskNew.globalSize);
 						task.comQuePtr->run(kernel, taskNew.globalOffset, taskNew.globalSize, taskNew.localSize, taskNew.offset);
 						task.comQuePtr->copyOutputsOfKernel(kernel, taskNew.globalOffset, taskNew.offset, taskNew.globalSize);
 						workLastCommand += taskNew.globalSize;
-						task.comQuePtr->sync();
+						enqueuedChunks.push_back(task.comQuePtr->marker());
+						task.comQuePtr->flush();
+					}
+					if (task.outOfCore)
+					{
+						uploadQueue.sync();
+						downloadQueue.sync();
 
+						// whole-array outputs are downloaded once, after kernels of all tiles
+						downloadQueue.copyOutputsOfKernel(kernels[task.kernelId], 0, 0, 0, true);
+						downloadQueue.sync();
 					}
+					task.comQuePtr->sync();
+					task.comQuePtr->downloadDeviceResults(kernels[task.kernelId]);
 
 				}
+				task.comQuePtr->collectTimings(nanoUpload, nanoKernel, nanoDownload);
+				uploadQueue.collectTimings(nanoUpload, nanoKernel, nanoDownload);
+				downloadQueue.collectTimings(nanoUpload, nanoKernel, nanoDownload);
 
 				break;
 			}
 
+			case (GPGPUTask::GPGPU_TASK_CLONE_KERNEL):
+			{
+				if (kernels.size() <= task.cloneId)
+					kernels.resize(task.cloneId + 1);
+				kernels[task.cloneId] = kernels[task.kernelId].clone();
+				break;
+			}
+
+			case (GPGPUTask::GPGPU_TASK_STREAM):
+			{
+				// upload of next batch overlaps kernel of this batch and download of previous batch
+				Kernel& kernel = kernels[task.kernelId];
+				GPGPUStreamBatch& batch = *task.streamBatchPtr;
+				uploadQueue.copyInputsOfKernel(kernel, task.globalOffset, task.offset, task.globalSize);
+				queue.waitFor(std::vector<cl::Event>{ uploadQueue.marker() });
+				queue.run(kernel, task.globalOffset, task.globalSize, task.localSize, task.offset);
+				downloadQueue.waitFor(std::vector<cl::Event>{ queue.marker() });
+				downloadQueue.copyOutputsOfKernel(kernel, task.globalOffset, task.offset, task.globalSize);
+				batch.completion = downloadQueue.marker();
+
+				batch.uploadEvents.clear();
+				batch.kernelEvents.clear();
+				batch.downloadEvents.clear();
+				batch.uploadEvents.swap(uploadQueue.uploadEvents);
+				batch.kernelEvents.swap(queue.kernelEvents);
+				batch.downloadEvents.swap(downloadQueue.downloadEvents);
+
+				uploadQueue.flush();
+				queue.flush();
+				downloadQueue.flush();
+				break;
+			}
+
+			case (GPGPUTask::GPGPU_TASK_RESIDENT_TO_HOST):
+			{
+				queue.readRange(parameters[task.parameterId], task.offset, task.globalSize);
+				break;
+			}
+
+			case (GPGPUTask::GPGPU_TASK_RESIDENT_TO_DEVICE):
+			{
+				Parameter& parameter = parameters[task.parameterId];
+				queue.writeRange(parameter, 0, parameter.n * parameter.elementSize);
+				parameter.resident->writes.clear();
+				break;
+			}
+
+			case (GPGPUTask::GPGPU_TASK_RESIDENT_RANGE_TO_DEVICE):
+			{
+				queue.writeRange(parameters[task.parameterId], task.offset, task.globalSize);
+				break;
+			}
+
 			case (GPGPUTask::GPGPU_TASK_ARG):
 			{
 
-				Kernel& kernel = mapKernelNameToKernel[task.kernelName];
-				Parameter& parameter = mapParameterNameToParameter[task.parameterName];
+				Kernel& kernel = kernels[task.kernelId];
+				Parameter& parameter = parameters[task.parameterId];
 				task.comQuePtr->setPrm(kernel, parameter, task.parameterPosition);
 				break;
 			}
@@ -139,10 +278,13 @@ namespace GPGPU_LIB
 			{
 
 				std::unique_lock<std::mutex> lock(commonSync);
-				if (task.taskType == GPGPUTask::GPGPU_TASK_COMPUTE || task.taskType == GPGPUTask::GPGPU_TASK_COMPUTE_ALL)
+				if (task.taskType == GPGPUTask::GPGPU_TASK_COMPUTE || task.taskType == GPGPUTask::GPGPU_TASK_COMPUTE_ALL || task.taskType == GPGPUTask::GPGPU_TASK_COMPUTE_MULTIPLE)
 				{
-					benchmarks[task.kernelName] = nanoLastCommand;
-					works[task.kernelName] = workLastCommand;
+					benchmarks[task.kernelId] = nanoLastCommand;
+					works[task.kernelId] = workLastCommand;
+					uploadBenchmarks[task.kernelId] = nanoUpload;
+					kernelBenchmarks[task.kernelId] = nanoKernel;
+					downloadBenchmarks[task.kernelId] = nanoDownload;
 				}
 
 
@@ -180,32 +322,99 @@ namespace GPGPU_LIB
 		}
 	}
 
-	void Worker::runTasks(std::shared_ptr<GPGPUTaskQueue> taskQueueShared, std::string kernelName)
+	void Worker::runTasks(GPGPUTaskQueue* taskQueueShared, int kernelId, int chunksInFlight, bool outOfCore)
 	{
 		GPGPUTask task;
 		task.taskType = GPGPUTask::GPGPU_TASK_COMPUTE_ALL;
 		task.sharedTaskQueue = taskQueueShared;
 		task.comQuePtr = &queue;
-		task.kernelName = kernelName;
+		task.kernelId = kernelId;
+		task.chunksInFlight = chunksInFlight;
+		task.outOfCore = outOfCore;
 		taskQueue.push(task);
 	}
 
-	void Worker::compile(std::string kernel, std::string kernelName, std::mutex* compileLock)
+	void Worker::runTasks(GPGPUWorkStealingQueue* stealingQueue, int workerIndex, int kernelId, int chunksInFlight, bool outOfCore)
 	{
+		GPGPUTask task;
+		task.taskType = GPGPUTask::GPGPU_TASK_COMPUTE_ALL;
+		task.stealingQueue = stealingQueue;
+		task.workerIndex = workerIndex;
+		task.comQuePtr = &queue;
+		task.kernelId = kernelId;
+		task.chunksInFlight = chunksInFlight;
+		task.outOfCore = outOfCore;
+		taskQueue.push(task);
+	}
+
+	void Worker::runTasks(GPGPUGuidedTaskQueue* guidedQueue, int workerIndex, int kernelId, int chunksInFlight, bool outOfCore)
+	{
+		GPGPUTask task;
+		task.taskType = GPGPUTask::GPGPU_TASK_COMPUTE_ALL;
+		task.guidedQueue = guidedQueue;
+		task.workerIndex = workerIndex;
+		task.comQuePtr = &queue;
+		task.kernelId = kernelId;
+		task.chunksInFlight = chunksInFlight;
+		task.outOfCore = outOfCore;
+		taskQueue.push(task);
+	}
+
+	void Worker::addBalanceKey(int keyId)
+	{
+		std::unique_lock<std::mutex> lock(commonSync);
+		if (benchmarks.size() <= keyId)
+		{
+			benchmarks.resize(keyId + 1, 1);
+			works.resize(keyId + 1, 1);
+			uploadBenchmarks.resize(keyId + 1, 0);
+			kernelBenchmarks.resize(keyId + 1, 0);
+			downloadBenchmarks.resize(keyId + 1, 0);
+		}
+	}
+
+	void Worker::compile(const std::string& kernel, const std::string& kernelName, int kernelId, std::mutex* compileLock)
+	{
+		addBalanceKey(kernelId);
 		{
 			std::unique_lock<std::mutex> lock(commonSync);
-			benchmarks[kernelName] = 1;
+			benchmarks[kernelId] = 1;
+			works[kernelId] = 1;
 		}
 		GPGPUTask task;
 		task.taskType = GPGPUTask::GPGPU_TASK_COMPILE;
-		task.kernelCode = kernel;
-		task.kernelName = kernelName;
+		task.kernelCode = &kernel;
+		task.kernelFunction = &kernelName;
+		task.kernelId = kernelId;
 		task.conPtr = &context;
 		task.mutexPtr = compileLock;
 		taskQueue.push(task);
 		waitAllTasks();
 	}
 
+	void Worker::cloneKernel(int kernelId, int cloneId)
+	{
+		GPGPUTask task;
+		task.taskType = GPGPUTask::GPGPU_TASK_CLONE_KERNEL;
+		task.kernelId = kernelId;
+		task.cloneId = cloneId;
+		taskQueue.push(task);
+		waitAllTasks();
+	}
+
+	void Worker::stream(int kernelId, size_t globalOffset, size_t offset, size_t numGlobal, size_t numLocal, GPGPUStreamBatch* batch)
+	{
+		GPGPUTask task;
+		task.taskType = GPGPUTask::GPGPU_TASK_STREAM;
+		task.kernelId = kernelId;
+		task.globalOffset = globalOffset;
+		task.offset = offset;
+		task.globalSize = numGlobal;
+		task.localSize = numLocal;
+		task.streamBatchPtr = batch;
+		taskQueue.push(task);
+	}
+
 	void Worker::mirror(GPGPU::HostParameter* hostParameter)
 	{
 		GPGPUTask task;
@@ -216,12 +425,65 @@ namespace GPGPU_LIB
 		waitAllTasks();
 	}
 
-	void Worker::setArg(std::string kernelName, std::string parameterName, int parameterIndex)
+	void Worker::downloadResident(int parameterId, size_t offsetBytes, size_t sizeBytes)
+	{
+		GPGPUTask task;
+		task.taskType = GPGPUTask::GPGPU_TASK_RESIDENT_TO_HOST;
+		task.parameterId = parameterId;
+		task.offset = offsetBytes;
+		task.globalSize = sizeBytes;
+		taskQueue.push(task);
+	}
+
+	void Worker::uploadResident(int parameterId)
+	{
+		GPGPUTask task;
+		task.taskType = GPGPUTask::GPGPU_TASK_RESIDENT_TO_DEVICE;
+		task.parameterId = parameterId;
+		taskQueue.push(task);
+	}
+
+	void Worker::uploadResidentRange(int parameterId, size_t offsetBytes, size_t sizeBytes)
+	{
+		GPGPUTask task;
+		task.taskType = GPGPUTask::GPGPU_TASK_RESIDENT_RANGE_TO_DEVICE;
+		task.parameterId = parameterId;
+		task.offset = offsetBytes;
+		task.globalSize = sizeBytes;
+		taskQueue.push(task);
+	}
+
+	std::vector<DeviceWrite> Worker::residentWrites(int parameterId)
+	{
+		if (parameterId < parameters.size())
+			return parameters[parameterId].resident->writes;
+		return std::vector<DeviceWrite>();
+	}
+
+	const int8_t* Worker::takeReductionPartial(int parameterId)
+	{
+		if (parameterId >= parameters.size() || !parameters[parameterId].reduction || !parameters[parameterId].reduction->ready)
+			return nullptr;
+
+		parameters[parameterId].reduction->ready = false;
+		return parameters[parameterId].reduction->partial.data();
+	}
+
+	AppendData* Worker::takeAppendResult(int parameterId)
+	{
+		if (parameterId >= parameters.size() || !parameters[parameterId].append || !parameters[parameterId].append->ready)
+			return nullptr;
+
+		parameters[parameterId].append->ready = false;
+		return parameters[parameterId].append.get();
+	}
+
+	void Worker::setArg(int kernelId, int parameterId, int parameterIndex)
 	{
 		GPGPUTask task;
 		task.taskType = GPGPUTask::GPGPU_TASK_ARG;
-		task.kernelName = kernelName;
-		task.parameterName = parameterName;
+		task.kernelId = kernelId;
+		task.parameterId = parameterId;
 		task.parameterPosition = parameterIndex;
 		task.comQuePtr = &queue;
 		taskQueue.push(task);
@@ -233,29 +495,71 @@ namespace GPGPU_LIB
 		retireQueue.pop();
 	}
 
-	void Worker::run(std::string kernelName, size_t globalOffset, size_t offset, size_t numGlobal, size_t numLocal, bool multipleKernels, std::vector<std::string> kernelNames)
+	cl::Event Worker::computeTile(Kernel& kernel, const GPGPUTask& tile, size_t tileIndex)
 	{
-		GPGPUTask task;
-		if (multipleKernels)
-		{
-			task.taskType = GPGPUTask::GPGPU_TASK_COMPUTE_MULTIPLE;
-			task.kernelNames = kernelNames;
-			task.offset = offset;
-			task.globalSize = numGlobal;
-			task.localSize = numLocal;
-			task.globalOffset = globalOffset;
-			task.comQuePtr = &queue;
-		}
-		else
+		const int slot = tileIndex % TileData::numSlots;
+
+		// whole-array and other non-tiled inputs are uploaded once (unchanged host data is skipped), tiles every time
+		if (tileSlotFree[slot]())
+			uploadQueue.waitFor(std::vector<cl::Event>{ tileSlotFree[slot] });
+		queue.bindTileSlots(kernel, context.context, tile.globalSize, slot);
+		uploadQueue.copyInputsOfKernel(kernel, tile.globalOffset, tile.offset, tile.globalSize, tileIndex == 0);
+		uploadQueue.copyTileInputsOfKernel(kernel, tile.globalOffset, tile.offset, tile.globalSize, slot);
+
+		queue.waitFor(std::vector<cl::Event>{ uploadQueue.marker() });
+		queue.run(kernel, 0, tile.globalSize, tile.localSize, 0);
+
+		downloadQueue.waitFor(std::vector<cl::Event>{ queue.marker() });
+		downloadQueue.copyTileOutputsOfKernel(kernel, tile.globalOffset, tile.offset, tile.globalSize, slot);
+		downloadQueue.copyOutputsOfKernel(kernel, tile.globalOffset, tile.offset, tile.globalSize, false);
+		tileSlotFree[slot] = downloadQueue.marker();
+
+		uploadQueue.flush();
+		queue.flush();
+		downloadQueue.flush();
+		return tileSlotFree[slot];
+	}
+
+	void Worker::computeOverlapped(Kernel& kernel, const GPGPUTask& task)
+	{
+		const size_t numGroups = task.globalSize / task.localSize;
+		const size_t numChunks = std::max((size_t)1, std::min((size_t)task.overlapChunks, numGroups));
+		size_t done = 0;
+		for (size_t i = 0; i < numChunks; i++)
 		{
-			task.taskType = GPGPUTask::GPGPU_TASK_COMPUTE;
-			task.kernelName = kernelName;
-			task.offset = offset;
-			task.globalSize = numGlobal;
-			task.localSize = numLocal;
-			task.globalOffset = globalOffset;
-			task.comQuePtr = &queue;
+			const size_t chunkSize = (i == numChunks - 1) ? (task.globalSize - done) : ((numGroups / numChunks) * task.localSize);
+			const size_t chunkOffset = task.offset + done;
+
+			// whole-array inputs are uploaded with first chunk, whole-array outputs are downloaded after last kernel
+			uploadQueue.copyInputsOfKernel(kernel, task.globalOffset, chunkOffset, chunkSize, i == 0);
+			queue.waitFor(std::vector<cl::Event>{ uploadQueue.marker() });
+			queue.run(kernel, task.globalOffset, chunkSize, task.localSize, chunkOffset);
+			downloadQueue.waitFor(std::vector<cl::Event>{ queue.marker() });
+			downloadQueue.copyOutputsOfKernel(kernel, task.globalOffset, chunkOffset, chunkSize, i == numChunks - 1);
+			done += chunkSize;
+
+			uploadQueue.flush();
+			queue.flush();
+			downloadQueue.flush();
 		}
+		uploadQueue.sync();
+		queue.sync();
+		downloadQueue.sync();
+	}
+
+	void Worker::run(int kernelId, size_t globalOffset, size_t offset, size_t numGlobal, size_t numLocal, const int* kernelIds, int numKernels, int overlapChunks)
+	{
+		GPGPUTask task;
+		task.taskType = (kernelIds != nullptr) ? GPGPUTask::GPGPU_TASK_COMPUTE_MULTIPLE : GPGPUTask::GPGPU_TASK_COMPUTE;
+		task.kernelId = kernelId; // key of load-balancing data for multiple kernels
+		task.kernelIds = kernelIds;
+		task.numKernels = numKernels;
+		task.offset = offset;
+		task.globalSize = numGlobal;
+		task.localSize = numLocal;
+		task.globalOffset = globalOffset;
+		task.comQuePtr = &queue;
+		task.overlapChunks = (kernelIds != nullptr) ? 1 : overlapChunks;
 		taskQueue.push(task);
 	}
 
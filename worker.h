@@ -19,15 +19,27 @@ namespace GPGPU_LIB
 		std::condition_variable cond;
 		Context context;
 		CommandQueue queue;
-		std::map<std::string, Kernel> mapKernelNameToKernel;
-		std::map<std::string, Parameter> mapParameterNameToParameter;
+
+		// extra queues on same context for overlapping uploads and downloads with kernels of other chunks or batches (overlapped compute, streaming)
+		CommandQueue uploadQueue;
+		CommandQueue downloadQueue;
+
+		// indexed by kernel id and parameter id (given by Computer), only accessed by worker thread
+		std::vector<Kernel> kernels;
+		std::vector<Parameter> parameters;
 		GPGPUTaskQueue taskQueue;
 		GPGPUTaskQueue retireQueue;
 		bool working;
 
 
-		std::map<std::string, double> benchmarks;
-		std::map<std::string, size_t> works;
+		// last run time and work of each load-balancing key (kernel id or kernel group id), accessed under commonSync
+		std::vector<double> benchmarks;
+		std::vector<size_t> works;
+
+		// device-side durations (nanoseconds) of uploads, kernels and downloads of last run (measured with OpenCL event profiling)
+		std::vector<double> uploadBenchmarks;
+		std::vector<double> kernelBenchmarks;
+		std::vector<double> downloadBenchmarks;
 		std::thread workerThread;
 		Worker(Device dev);
 
@@ -35,17 +47,66 @@ namespace GPGPU_LIB
 
 		void stop();
 
-		void runTasks(std::shared_ptr<GPGPUTaskQueue> taskQueueShared, std::string kernelName);
+		// chunk sources must outlive the task (until waitAllTasks)
+		// outOfCore = true: each chunk is a tile of out-of-core parameters (computeTile)
+		void runTasks(GPGPUTaskQueue* taskQueueShared, int kernelId, int chunksInFlight = 1, bool outOfCore = false);
+
+		// same as runTasks but consumes chunks from work-stealing deques, workerIndex selects own deque
+		void runTasks(GPGPUWorkStealingQueue* stealingQueue, int workerIndex, int kernelId, int chunksInFlight = 1, bool outOfCore = false);
+
+		// same as runTasks but takes chunks of decreasing size from guided queue
+		void runTasks(GPGPUGuidedTaskQueue* guidedQueue, int workerIndex, int kernelId, int chunksInFlight = 1, bool outOfCore = false);
+
+		void compile(const std::string& kernel, const std::string& kernelName, int kernelId, std::mutex* compileLock);
+
+		// makes benchmark storage big enough for a new load-balancing key (kernel id or kernel group id)
+		void addBalanceKey(int keyId);
+
+		// creates kernel cloneId from compiled kernel kernelId, with its own parameter bindings
+		void cloneKernel(int kernelId, int cloneId);
 
-		void compile(std::string kernel, std::string kernelName, std::mutex* compileLock);
+		// enqueues upload on uploadQueue, kernel on queue, download on downloadQueue (each waiting previous stage) and returns without waiting device
+		// events of commands are written to batch
+		void stream(int kernelId, size_t globalOffset, size_t offset, size_t numGlobal, size_t numLocal, GPGPUStreamBatch* batch);
 
 		void mirror(GPGPU::HostParameter* hostParameter);
 
-		void setArg(std::string kernelName, std::string parameterName, int parameterIndex);
+		void setArg(int kernelId, int parameterId, int parameterIndex);
+
+		// blocking copies of a resident parameter (completed at waitAllTasks)
+		void downloadResident(int parameterId, size_t offsetBytes, size_t sizeBytes);
+		void uploadResident(int parameterId);
+
+		// blocking upload of bytes [offsetBytes, offsetBytes + sizeBytes) of a resident parameter (completed at waitAllTasks), recorded writes are kept
+		void uploadResidentRange(int parameterId, size_t offsetBytes, size_t sizeBytes);
+
+		// ranges of a resident parameter written by kernels of this device since last uploadResident
+		// only called when worker has no tasks (after waitAllTasks)
+		std::vector<DeviceWrite> residentWrites(int parameterId);
+
+		// partial result of a reduction parameter downloaded in last run (nullptr if this device did not run a kernel using it since last call)
+		// only called when worker has no tasks
+		const int8_t* takeReductionPartial(int parameterId);
+
+		// appended elements of an append buffer downloaded in last run (nullptr if this device did not run a kernel using it since last call)
+		// only called when worker has no tasks
+		AppendData* takeAppendResult(int parameterId);
 
 		void waitAllTasks();
 
-		void run(std::string kernelName, size_t globalOffset, size_t offset, size_t numGlobal, size_t numLocal, bool multipleKernels = false, std::vector<std::string> kernelNames = std::vector<std::string>());
+		// kernelIds != nullptr: runs numKernels kernels in order and records benchmark for kernelId (key of kernel group). kernelIds must outlive the task
+		// overlapChunks > 1: single kernel range is computed in that many sub-chunks so that copy of a sub-chunk overlaps kernel of another
+		void run(int kernelId, size_t globalOffset, size_t offset, size_t numGlobal, size_t numLocal, const int* kernelIds = nullptr, int numKernels = 0, int overlapChunks = 1);
+
+		// computes a tile in tile slot (tileIndex % number of slots) on uploadQueue, queue and downloadQueue: upload of next tile and download of previous tile overlap its kernel
+		// kernel sees work-items of tile as [0, tile.globalSize), returns event that completes when outputs of tile are downloaded
+		cl::Event computeTile(Kernel& kernel, const GPGPUTask& tile, size_t tileIndex);
+
+		// download completion of last tile that used each tile slot (a slot is overwritten only after it)
+		cl::Event tileSlotFree[TileData::numSlots];
+
+		// computes range of a compute task in sub-chunks on uploadQueue, queue and downloadQueue: upload of chunk i+1 and download of chunk i-1 overlap kernel of chunk i
+		void computeOverlapped(Kernel& kernel, const GPGPUTask& task);
 
 		std::string deviceName();
 		std::string deviceNameSimple();